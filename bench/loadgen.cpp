@@ -0,0 +1,378 @@
+/**
+ * Load generator for MattDaemon.
+ *
+ * Scenarios:
+ * - storm: `connections` clients (re)connect all at once, each sends one
+ * line and waits for its ACK (or to be rejected), `rounds` times in a row.
+ * Simulates every producer reconnecting after a network blip.
+ * - latency: `connections` clients each send `messages` lines one at a time,
+ * waiting for the ACK of each before sending the next, and the ACK round
+ * trip times are reported as percentiles, along with the daemon's CPU use
+ * (read from /proc, using the pid in its pidfile).
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string scenario;
+    std::string host = "127.0.0.1";
+    uint16_t port = 4242;
+    int connections = 500;
+    int rounds = 5;
+    int messages = 10000;
+    std::string pidfile = "/var/run/matt_daemon.pid";
+};
+
+enum class Outcome { PENDING,
+                     ACKED,
+                     REJECTED,
+                     FAILED };
+
+struct Connection {
+    int fd;
+    Clock::time_point start;
+    Clock::duration elapsed;
+    bool sent;
+    std::string received;
+    Outcome outcome;
+};
+
+static void usage(const char *progname) {
+    std::cerr << "Usage: " << progname << " storm [-c connections] [-r rounds] [-H host] [-p port]\n"
+              << "       " << progname << " latency [-c connections] [-n messages] [-P pidfile] [-H host] [-p port]\n";
+    exit(EXIT_FAILURE);
+}
+
+static Options parseOptions(int argc, char **argv) {
+    if (argc < 2) {
+        usage(argv[0]);
+    }
+
+    Options options;
+    options.scenario = argv[1];
+    if (options.scenario == "latency") {
+        options.connections = 1;
+    }
+
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "c:r:n:P:H:p:")) != -1) {
+        switch (opt) {
+            case 'c':
+                options.connections = std::atoi(optarg);
+                break;
+            case 'r':
+                options.rounds = std::atoi(optarg);
+                break;
+            case 'n':
+                options.messages = std::atoi(optarg);
+                break;
+            case 'P':
+                options.pidfile = optarg;
+                break;
+            case 'H':
+                options.host = optarg;
+                break;
+            case 'p':
+                options.port = static_cast<uint16_t>(std::atoi(optarg));
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if ((options.scenario != "storm" && options.scenario != "latency")
+        || options.connections <= 0 || options.rounds <= 0 || options.messages <= 0) {
+        usage(argv[0]);
+    }
+    return options;
+}
+
+static double toMs(Clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+/**
+ * @param sorted Sorted samples
+ * @param p Percentile, in [0, 100]
+ */
+template <typename T>
+static T percentile(const std::vector<T> &sorted, double p) {
+    if (sorted.empty()) {
+        return T();
+    }
+    size_t rank = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+/**
+ * Runs one storm round: opens every connection at once, sends a line on
+ * each as soon as it's connected and waits until they all got an answer.
+ */
+static void stormRound(const Options &options, const sockaddr_in &address, int round) {
+    int epollfd = epoll_create1(0);
+    if (epollfd == -1) {
+        std::cerr << "loadgen: epoll_create1() failed: " << strerror(errno) << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<Connection> connections(options.connections);
+    int pending = 0;
+    Clock::time_point roundStart = Clock::now();
+
+    for (int i = 0; i < options.connections; i++) {
+        Connection &conn = connections[i];
+        conn.start = Clock::now();
+        conn.sent = false;
+        conn.outcome = Outcome::FAILED;
+        conn.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (conn.fd == -1) {
+            continue;
+        }
+        if (connect(conn.fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == -1 && errno != EINPROGRESS) {
+            close(conn.fd);
+            conn.fd = -1;
+            continue;
+        }
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT;
+        ev.data.u32 = i;
+        epoll_ctl(epollfd, EPOLL_CTL_ADD, conn.fd, &ev);
+        conn.outcome = Outcome::PENDING;
+        pending += 1;
+    }
+
+    std::vector<struct epoll_event> events(1024);
+    while (pending > 0) {
+        int nfds = epoll_wait(epollfd, events.data(), events.size(), 10000);
+        if (nfds <= 0) {
+            break;
+        }
+
+        for (int n = 0; n < nfds; n++) {
+            Connection &conn = connections[events[n].data.u32];
+            if (conn.outcome != Outcome::PENDING) {
+                continue;
+            }
+
+            if ((events[n].events & EPOLLOUT) && !conn.sent) {
+                std::string line = "storm round " + std::to_string(round) + " client " + std::to_string(events[n].data.u32) + "\n";
+                if (send(conn.fd, line.data(), line.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(line.size())) {
+                    conn.sent = true;
+                    struct epoll_event ev;
+                    ev.events = EPOLLIN;
+                    ev.data.u32 = events[n].data.u32;
+                    epoll_ctl(epollfd, EPOLL_CTL_MOD, conn.fd, &ev);
+                }
+            }
+
+            if (events[n].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                char buf[256];
+                ssize_t rd = recv(conn.fd, buf, sizeof(buf), 0);
+                if (rd > 0) {
+                    conn.received.append(buf, rd);
+                }
+                if (conn.received.find("ACK") != std::string::npos) {
+                    conn.outcome = Outcome::ACKED;
+                } else if (conn.received.find("Rejected") != std::string::npos) {
+                    conn.outcome = Outcome::REJECTED;
+                } else if (rd == 0 || (rd == -1 && errno != EAGAIN)) {
+                    // Closed without a word, e.g. out of fds on the daemon's side
+                    conn.outcome = Outcome::FAILED;
+                } else {
+                    continue;
+                }
+                conn.elapsed = Clock::now() - conn.start;
+                pending -= 1;
+            }
+        }
+    }
+    Clock::duration roundTime = Clock::now() - roundStart;
+
+    int acked = 0;
+    int rejected = 0;
+    int failed = 0;
+    std::vector<double> latencies;
+    for (Connection &conn : connections) {
+        switch (conn.outcome) {
+            case Outcome::ACKED:
+                acked += 1;
+                latencies.push_back(toMs(conn.elapsed));
+                break;
+            case Outcome::REJECTED:
+                rejected += 1;
+                latencies.push_back(toMs(conn.elapsed));
+                break;
+            default:
+                failed += 1;
+                break;
+        }
+        if (conn.fd != -1) {
+            close(conn.fd);
+        }
+    }
+    close(epollfd);
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << "round " << round << ": "
+              << acked << " acked, " << rejected << " rejected, " << failed << " failed/timed out"
+              << " in " << toMs(roundTime) << " ms"
+              << " | connect-to-answer p50=" << percentile(latencies, 50)
+              << " ms p99=" << percentile(latencies, 99)
+              << " ms max=" << percentile(latencies, 100) << " ms\n";
+}
+
+/**
+ * @return CPU time (user + system) used so far by process `pid`, in clock
+ * ticks, or -1 if it can't be read
+ */
+static long cpuTicks(pid_t pid) {
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string content;
+    if (pid <= 0 || !std::getline(stat, content)) {
+        return -1;
+    }
+
+    // Skip "pid (comm) ", comm may contain spaces
+    std::istringstream fields(content.substr(content.rfind(')') + 2));
+    std::string field;
+    long utime = 0;
+    long stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; i++) {
+        if (i == 14) {
+            utime = std::atol(field.c_str());
+        } else if (i == 15) {
+            stime = std::atol(field.c_str());
+        }
+    }
+    return utime + stime;
+}
+
+/**
+ * Sends `messages` lines on a new connection, one at a time, and records
+ * the time until each one is acknowledged.
+ */
+static void latencyClient(const Options &options, const sockaddr_in &address, int id, std::vector<Clock::duration> &samples) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) == -1) {
+        std::cerr << "loadgen: client " << id << ": failed to connect: " << strerror(errno) << "\n";
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+
+    int enable = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+    std::string line = "latency client " + std::to_string(id) + "\n";
+    std::string received;
+    char buf[256];
+    samples.reserve(options.messages);
+
+    for (int i = 0; i < options.messages; i++) {
+        Clock::time_point start = Clock::now();
+        if (send(fd, line.data(), line.size(), MSG_NOSIGNAL) != static_cast<ssize_t>(line.size())) {
+            break;
+        }
+
+        size_t ack;
+        while ((ack = received.find("ACK\n")) == std::string::npos) {
+            ssize_t rd = recv(fd, buf, sizeof(buf), 0);
+            if (rd <= 0) {
+                std::cerr << "loadgen: client " << id << ": connection lost\n";
+                close(fd);
+                return;
+            }
+            received.append(buf, rd);
+        }
+        samples.push_back(Clock::now() - start);
+
+        // ACKs are followed by a NUL byte
+        received.erase(0, std::min(ack + sizeof("ACK\n"), received.size()));
+    }
+
+    close(fd);
+}
+
+static void latency(const Options &options, const sockaddr_in &address) {
+    pid_t pid = -1;
+    std::ifstream pidfile(options.pidfile);
+    pidfile >> pid;
+
+    std::vector<std::vector<Clock::duration>> samples(options.connections);
+    std::vector<std::thread> clients;
+
+    long ticksBefore = cpuTicks(pid);
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < options.connections; i++) {
+        clients.emplace_back(latencyClient, std::cref(options), std::cref(address), i, std::ref(samples[i]));
+    }
+    for (std::thread &client : clients) {
+        client.join();
+    }
+    Clock::duration wall = Clock::now() - start;
+    long ticksAfter = cpuTicks(pid);
+
+    std::vector<double> latencies;
+    for (const auto &clientSamples : samples) {
+        for (Clock::duration sample : clientSamples) {
+            latencies.push_back(std::chrono::duration<double, std::micro>(sample).count());
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    std::cout << latencies.size() << " messages acked in " << toMs(wall) << " ms"
+              << " | ACK latency p50=" << percentile(latencies, 50)
+              << " us p90=" << percentile(latencies, 90)
+              << " us p99=" << percentile(latencies, 99)
+              << " us p99.9=" << percentile(latencies, 99.9)
+              << " us max=" << percentile(latencies, 100) << " us";
+    if (ticksBefore != -1 && ticksAfter != -1) {
+        double cpuSeconds = static_cast<double>(ticksAfter - ticksBefore) / sysconf(_SC_CLK_TCK);
+        std::cout << " | daemon CPU " << 100.0 * cpuSeconds / std::chrono::duration<double>(wall).count() << "%";
+    }
+    std::cout << "\n";
+}
+
+int main(int argc, char **argv) {
+    Options options = parseOptions(argc, argv);
+
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(options.port);
+    if (inet_pton(AF_INET, options.host.c_str(), &address.sin_addr) != 1) {
+        std::cerr << "loadgen: invalid host: " << options.host << "\n";
+        return EXIT_FAILURE;
+    }
+
+    if (options.scenario == "latency") {
+        latency(options, address);
+        return EXIT_SUCCESS;
+    }
+
+    for (int round = 1; round <= options.rounds; round++) {
+        stormRound(options, address, round);
+    }
+    return EXIT_SUCCESS;
+}
@@ -7,6 +7,24 @@
 
 Client::Client(int socketfd) noexcept {
     this->socketfd = socketfd;
+    this->admin = false;
+    this->oversized = false;
+    this->paused = false;
+    this->protocol = Protocol::TEXT;
+    this->shard = 0;
+    this->pendingAcks = 0;
+    this->ackSeqPending = false;
+    this->ackSeq = 0;
+    this->events = 0;
+    this->transferFd = -1;
+    this->transferOffset = 0;
+    this->transferEnd = 0;
+    this->following = false;
+    this->followSeq = 0;
+#if MATT_TRACE
+    this->traceRecv = 0;
+    this->traceLastRecv = 0;
+#endif
 }
 
 Client::Client(const Client &rhs) noexcept {
@@ -18,13 +36,41 @@ Client::Client(const Client &rhs) noexcept {
 Client &Client::operator=(const Client &rhs) noexcept {
     if (this != &rhs) {
         this->socketfd = rhs.socketfd;
+        this->admin = rhs.admin;
         this->msg = rhs.msg;
+        this->oversized = rhs.oversized;
+        this->paused = rhs.paused;
+        this->protocol = rhs.protocol;
+        this->shard = rhs.shard;
+        this->pendingAcks = rhs.pendingAcks;
+        this->ackSeqPending = rhs.ackSeqPending;
+        this->ackSeq = rhs.ackSeq;
+        this->events = rhs.events;
+        this->outbuf = rhs.outbuf;
+        this->transferFd = rhs.transferFd;
+        this->transferOffset = rhs.transferOffset;
+        this->transferEnd = rhs.transferEnd;
+        this->nextTransfers = rhs.nextTransfers;
+        this->afterTransfer = rhs.afterTransfer;
+        this->following = rhs.following;
+        this->followSeq = rhs.followSeq;
+#if MATT_TRACE
+        this->traceRecv = rhs.traceRecv;
+        this->traceLastRecv = rhs.traceLastRecv;
+        this->traceSamples = rhs.traceSamples;
+#endif
     }
     return *this;
 };
 
 Client::~Client(void) noexcept {
     close(this->socketfd);
+    if (this->transferFd != -1) {
+        close(this->transferFd);
+    }
+    for (const Transfer &transfer : this->nextTransfers) {
+        close(transfer.fd);
+    }
 };
 
 std::ostream &operator<<(std::ostream &stream, const Client &client) noexcept {
@@ -1,6 +1,22 @@
 #pragma once
 
+#include <sys/types.h>
+
+#include <cstdint>
 #include <string>
+#include <vector>
+
+#include "trace.hpp"
+
+enum class Protocol { TEXT,
+                      BINARY };
+
+// Byte range of a file to stream to a client
+struct Transfer {
+    int fd;
+    off_t begin;
+    off_t end;
+};
 
 class Client {
 public:
@@ -10,7 +26,29 @@ public:
     ~Client(void) noexcept;
 
     int socketfd;
+    bool admin;
     std::string msg;
+    bool oversized;
+    bool paused;
+    Protocol protocol;
+    size_t shard;
+    int pendingAcks;
+    bool ackSeqPending;
+    uint64_t ackSeq;
+    uint32_t events;
+    std::string outbuf;
+    int transferFd;
+    off_t transferOffset;
+    off_t transferEnd;
+    std::vector<Transfer> nextTransfers;  // Queued behind the current transfer
+    std::string afterTransfer;
+    bool following;
+    uint64_t followSeq;
+#if MATT_TRACE
+    uint64_t traceRecv;      // Read of the first byte of the line or frame at the front of msg
+    uint64_t traceLastRecv;  // Latest read
+    std::vector<TraceSample> traceSamples;
+#endif
 };
 
 std::ostream &operator<<(std::ostream &stream, const Client &client) noexcept;
@@ -0,0 +1,272 @@
+#include "Config.hpp"
+
+#include <getopt.h>
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "LogIndex.hpp"
+
+// Values for the long options without a short equivalent
+enum LongOnlyOption {
+    OPT_BACKLOG = 256,
+    OPT_DEFER_ACCEPT,
+    OPT_NODELAY,
+    OPT_RCVBUF,
+    OPT_BUSY_POLL,
+    OPT_SPIN,
+    OPT_CPU,
+    OPT_MAX_LINE,
+    OPT_OVERSIZE,
+    OPT_MEM_BUDGET,
+    OPT_SHARDS,
+    OPT_SHARD_BY,
+    OPT_MERGE,
+};
+
+/**
+ * Parses an integer option value.
+ *
+ * @param name Option name, used for error messages
+ * @param value Option value
+ * @param min Minimum accepted value
+ *
+ * @throws `std::invalid_argument`
+ */
+static int parseInt(const char *name, const char *value, int min = 1) {
+    char *end = nullptr;
+    errno = 0;
+    long n = std::strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || n < min || n > INT_MAX) {
+        throw std::invalid_argument(std::string("invalid value for --") + name + ": " + value);
+    }
+    return static_cast<int>(n);
+}
+
+/**
+ * @throws `std::invalid_argument`
+ */
+static Durability parseDurability(const char *value) {
+    std::string mode(value);
+    if (mode == "none") {
+        return Durability::NONE;
+    } else if (mode == "interval") {
+        return Durability::INTERVAL;
+    } else if (mode == "group") {
+        return Durability::GROUP;
+    }
+    throw std::invalid_argument(std::string("invalid durability mode: ") + value + " (expected none, interval or group)");
+}
+
+/**
+ * @throws `std::invalid_argument`
+ */
+static Oversize parseOversize(const char *value) {
+    std::string policy(value);
+    if (policy == "truncate") {
+        return Oversize::TRUNCATE;
+    } else if (policy == "split") {
+        return Oversize::SPLIT;
+    } else if (policy == "disconnect") {
+        return Oversize::DISCONNECT;
+    }
+    throw std::invalid_argument(std::string("invalid oversize policy: ") + value + " (expected truncate, split or disconnect)");
+}
+
+/**
+ * @throws `std::invalid_argument`
+ */
+static ShardBy parseShardBy(const char *value) {
+    std::string key(value);
+    if (key == "client") {
+        return ShardBy::CLIENT;
+    } else if (key == "addr") {
+        return ShardBy::ADDR;
+    } else if (key == "hash") {
+        return ShardBy::HASH;
+    }
+    throw std::invalid_argument(std::string("invalid shard key: ") + value + " (expected client, addr or hash)");
+}
+
+/**
+ * @throws `std::invalid_argument`
+ */
+static time_t parseTime(const char *name, const char *value) {
+    time_t timestamp;
+    if (!LogIndex::parseTimestamp(value, timestamp)) {
+        throw std::invalid_argument(std::string("invalid value for --") + name + ": " + value + " (expected seconds since the Epoch or \"DD/MM/YYYY HH:MM:SS\")");
+    }
+    return timestamp;
+}
+
+/**
+ * Prints the command line usage to stdout.
+ *
+ * @param progname Name the program was invoked with (`argv[0]`)
+ */
+void printUsage(const char *progname) noexcept {
+    std::cout << "Usage: " << progname << " [options]\n"
+              << "\n"
+              << "Options:\n"
+              << "  -d, --durability=MODE     logfile durability policy (default: none)\n"
+              << "                              none:     buffered, left to the page cache\n"
+              << "                              interval: fdatasync() every --sync-interval ms\n"
+              << "                              group:    one fdatasync() per event loop iteration,\n"
+              << "                                        ACKs are only sent once the lines are durable\n"
+              << "  -i, --sync-interval=MS    fdatasync() period for the interval mode (default: 1000)\n"
+              << "  -r, --recent-records=N    number of recent log records kept in memory for tail/follow (default: 1000)\n"
+              << "  -b, --recent-bytes=BYTES  memory budget of the recent log records (default: 1048576)\n"
+              << "      --shards=K            write client messages to K shard logfiles, matt_daemon.<0..K-1>.log,\n"
+              << "                            each with its own writer (default: 1, the main logfile only)\n"
+              << "      --shard-by=KEY        how messages are routed to shards (default: client)\n"
+              << "                              client: by connection\n"
+              << "                              addr:   by source address\n"
+              << "                              hash:   by message content\n"
+              << "  -m, --max-clients=N       maximum number of simultaneous clients (default: 3)\n"
+              << "      --max-line=BYTES      maximum length of a message (default: 65536)\n"
+              << "      --oversize=POLICY     what to do with longer ones (default: truncate)\n"
+              << "                              truncate:   log the first --max-line bytes, drop the rest\n"
+              << "                              split:      log them as several --max-line messages\n"
+              << "                              disconnect: drop the client\n"
+              << "      --mem-budget=BYTES    memory budget of the partial messages and unread output buffered\n"
+              << "                            for all clients, reading is throttled as it fills up\n"
+              << "                            (default: 16777216)\n"
+              << "      --backlog=N           listen() backlog (default: SOMAXCONN)\n"
+              << "      --defer-accept=SECS   only wake up for a connection once it has data (TCP_DEFER_ACCEPT),\n"
+              << "                            dropping it after SECS seconds without any\n"
+              << "      --nodelay             disable Nagle's algorithm on client sockets (TCP_NODELAY)\n"
+              << "      --rcvbuf=BYTES        receive buffer size of client sockets (SO_RCVBUF)\n"
+              << "      --busy-poll=USECS     let epoll_wait() busy poll the NIC queues for up to USECS before\n"
+              << "                            sleeping (EPIOCSPARAMS, Linux 6.9)\n"
+              << "      --spin-us=USECS       spin on non-blocking epoll_wait() for USECS before blocking\n"
+              << "      --cpu=N               pin the event loop to CPU N\n"
+              << "  -s, --since=TIME          print the logfile lines logged at or after TIME and exit\n"
+              << "  -u, --until=TIME          print the logfile lines logged at or before TIME and exit\n"
+              << "                            TIME is either seconds since the Epoch or \"DD/MM/YYYY HH:MM:SS\"\n"
+              << "      --merge               print the main logfile and its shards as a single time-ordered\n"
+              << "                            stream and exit\n"
+              << "  -h, --help                show this help and exit\n";
+}
+
+/**
+ * Parses the command line arguments into a `Config`.
+ *
+ * @param argc Argument count
+ * @param argv Argument vector
+ *
+ * @throws `std::invalid_argument` on unknown options or invalid values
+ */
+Config parseArgs(int argc, char **argv) {
+    static const struct option longOptions[] = {
+        {"durability", required_argument, nullptr, 'd'},
+        {"sync-interval", required_argument, nullptr, 'i'},
+        {"recent-records", required_argument, nullptr, 'r'},
+        {"recent-bytes", required_argument, nullptr, 'b'},
+        {"max-clients", required_argument, nullptr, 'm'},
+        {"shards", required_argument, nullptr, OPT_SHARDS},
+        {"shard-by", required_argument, nullptr, OPT_SHARD_BY},
+        {"max-line", required_argument, nullptr, OPT_MAX_LINE},
+        {"oversize", required_argument, nullptr, OPT_OVERSIZE},
+        {"mem-budget", required_argument, nullptr, OPT_MEM_BUDGET},
+        {"backlog", required_argument, nullptr, OPT_BACKLOG},
+        {"defer-accept", required_argument, nullptr, OPT_DEFER_ACCEPT},
+        {"nodelay", no_argument, nullptr, OPT_NODELAY},
+        {"rcvbuf", required_argument, nullptr, OPT_RCVBUF},
+        {"busy-poll", required_argument, nullptr, OPT_BUSY_POLL},
+        {"spin-us", required_argument, nullptr, OPT_SPIN},
+        {"cpu", required_argument, nullptr, OPT_CPU},
+        {"since", required_argument, nullptr, 's'},
+        {"until", required_argument, nullptr, 'u'},
+        {"merge", no_argument, nullptr, OPT_MERGE},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    Config config;
+
+    // Report errors ourselves
+    opterr = 0;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:i:r:b:m:s:u:h", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'd':
+                config.durability = parseDurability(optarg);
+                break;
+            case 'i':
+                config.syncIntervalMs = parseInt("sync-interval", optarg);
+                break;
+            case 'r':
+                config.recentRecords = parseInt("recent-records", optarg);
+                break;
+            case 'b':
+                config.recentBytes = parseInt("recent-bytes", optarg);
+                break;
+            case 'm':
+                config.maxClients = parseInt("max-clients", optarg);
+                break;
+            case OPT_SHARDS:
+                config.shards = parseInt("shards", optarg);
+                break;
+            case OPT_SHARD_BY:
+                config.shardBy = parseShardBy(optarg);
+                break;
+            case OPT_MAX_LINE:
+                config.maxLine = parseInt("max-line", optarg);
+                break;
+            case OPT_OVERSIZE:
+                config.oversize = parseOversize(optarg);
+                break;
+            case OPT_MEM_BUDGET:
+                config.memBudget = parseInt("mem-budget", optarg);
+                break;
+            case OPT_BACKLOG:
+                config.backlog = parseInt("backlog", optarg);
+                break;
+            case OPT_DEFER_ACCEPT:
+                config.deferAcceptSecs = parseInt("defer-accept", optarg);
+                break;
+            case OPT_NODELAY:
+                config.tcpNodelay = true;
+                break;
+            case OPT_RCVBUF:
+                config.rcvbuf = parseInt("rcvbuf", optarg);
+                break;
+            case OPT_BUSY_POLL:
+                config.busyPollUs = parseInt("busy-poll", optarg);
+                break;
+            case OPT_SPIN:
+                config.spinUs = parseInt("spin-us", optarg);
+                break;
+            case OPT_CPU:
+                config.cpu = parseInt("cpu", optarg, 0);
+                break;
+            case 's':
+                config.query = true;
+                config.since = parseTime("since", optarg);
+                break;
+            case 'u':
+                config.query = true;
+                config.until = parseTime("until", optarg);
+                break;
+            case OPT_MERGE:
+                config.merge = true;
+                break;
+            case 'h':
+                printUsage(argv[0]);
+                exit(EXIT_SUCCESS);
+            default:
+                throw std::invalid_argument(std::string("unknown or malformed option: ") + argv[optind - 1]);
+        }
+    }
+
+    if (optind < argc) {
+        throw std::invalid_argument(std::string("unexpected argument: ") + argv[optind]);
+    }
+
+    return config;
+}
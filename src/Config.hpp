@@ -0,0 +1,57 @@
+#pragma once
+
+#include <sys/socket.h>
+
+#include <cstddef>
+#include <ctime>
+#include <limits>
+
+#include "RecentRing.hpp"
+#include "Tintin_reporter.hpp"
+
+// What to do with a line longer than --max-line
+enum class Oversize { TRUNCATE,
+                      SPLIT,
+                      DISCONNECT };
+
+// How client messages are routed to shards
+enum class ShardBy { CLIENT,
+                     ADDR,
+                     HASH };
+
+struct Config {
+    Durability durability = Durability::NONE;
+    int syncIntervalMs = 1000;
+    size_t recentRecords = RecentRing::DEFAULT_MAX_RECORDS;
+    size_t recentBytes = RecentRing::DEFAULT_MAX_BYTES;
+    int shards = 1;
+    ShardBy shardBy = ShardBy::CLIENT;
+
+    // Accept path
+    int maxClients = 3;
+    int backlog = SOMAXCONN;
+    int deferAcceptSecs = 0;
+    bool tcpNodelay = false;
+    int rcvbuf = 0;
+
+    // Client memory bounds
+    size_t maxLine = 64 * 1024;
+    Oversize oversize = Oversize::TRUNCATE;
+    size_t memBudget = 16 * 1024 * 1024;
+
+    // Low-latency mode
+    int busyPollUs = 0;
+    int spinUs = 0;
+    int cpu = -1;
+
+    // Query mode: print the logfile lines logged between `since` and `until` and exit
+    bool query = false;
+    time_t since = 0;
+    time_t until = std::numeric_limits<time_t>::max();
+
+    // Merge mode: print the main logfile and its shards as a single time-ordered stream and exit
+    bool merge = false;
+};
+
+Config parseArgs(int argc, char **argv);
+void printUsage(const char *progname) noexcept;
@@ -0,0 +1,343 @@
+#include "LogIndex.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <string>
+
+#include "Tintin_reporter.hpp"
+
+LogIndex::LogIndex(const std::string &logfilePath) noexcept {
+    this->indexPath = logfilePath + INDEX_SUFFIX;
+    this->indexfd = open(this->indexPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    this->lastTimestamp = -1;
+}
+
+LogIndex::LogIndex(const LogIndex &rhs) noexcept {
+    this->indexfd = -1;
+    if (this != &rhs) {
+        *this = rhs;
+    }
+}
+
+LogIndex &LogIndex::operator=(const LogIndex &rhs) noexcept {
+    if (this != &rhs) {
+        if (this->indexfd != -1) {
+            this->flush();
+            close(this->indexfd);
+        }
+        this->indexPath = rhs.indexPath;
+        this->indexfd = open(rhs.indexPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        this->pending.clear();
+        this->lastTimestamp = rhs.lastTimestamp;
+    }
+    return *this;
+}
+
+LogIndex::~LogIndex(void) noexcept {
+    if (this->indexfd != -1) {
+        this->flush();
+        close(this->indexfd);
+    }
+}
+
+/**
+ * @return Whether the index file could be opened
+ */
+bool LogIndex::isValid(void) const noexcept {
+    return this->indexfd != -1;
+}
+
+/**
+ * Reads the last entry of the index file.
+ *
+ * @param entry Where to store the entry
+ *
+ * @return Whether there was an entry to read
+ */
+bool LogIndex::readLastEntry(Entry &entry) const noexcept {
+    struct stat st;
+    if (fstat(this->indexfd, &st) == -1 || st.st_size < static_cast<off_t>(sizeof(Entry))) {
+        return false;
+    }
+
+    off_t lastEntryOffset = (st.st_size / sizeof(Entry) - 1) * sizeof(Entry);
+    return pread(this->indexfd, &entry, sizeof(Entry), lastEntryOffset) == sizeof(Entry);
+}
+
+/**
+ * Indexes the lines of the logfile starting at offset `from`.
+ *
+ * @param logfilePath Path of the indexed logfile
+ * @param from Offset of a line start to scan from
+ */
+void LogIndex::scan(const std::string &logfilePath, off_t from) noexcept {
+    std::ifstream logfile(logfilePath, std::ios::binary);
+    if (!logfile.is_open()) {
+        return;
+    }
+    logfile.seekg(from);
+
+    off_t offset = from;
+    std::string line;
+    time_t timestamp;
+    while (std::getline(logfile, line)) {
+        if (parseLineTimestamp(line, timestamp)) {
+            this->record(timestamp, offset);
+        }
+        offset += line.size() + 1;
+    }
+
+    this->flush();
+}
+
+/**
+ * Brings the index up to date with the logfile. Lines appended after the
+ * last indexed entry (e.g. if the daemon died before flushing the index)
+ * get indexed, while a stale index (logfile rotated or truncated under us)
+ * is rebuilt from scratch.
+ *
+ * @param logfilePath Path of the indexed logfile
+ * @param logSize Current size of the logfile
+ */
+void LogIndex::catchUp(const std::string &logfilePath, off_t logSize) noexcept {
+    if (this->indexfd == -1) {
+        return;
+    }
+    this->pending.clear();
+
+    // Drop a torn trailing entry
+    struct stat st;
+    if (fstat(this->indexfd, &st) == 0 && st.st_size % sizeof(Entry) != 0) {
+        if (ftruncate(this->indexfd, st.st_size - st.st_size % sizeof(Entry)) == -1) {
+            return;
+        }
+    }
+
+    Entry last;
+    if (!this->readLastEntry(last)) {
+        this->lastTimestamp = -1;
+        this->scan(logfilePath, 0);
+        return;
+    }
+
+    // The last entry must still point at a line carrying its timestamp
+    bool stale = static_cast<off_t>(last.offset) >= logSize;
+    if (!stale) {
+        std::ifstream logfile(logfilePath, std::ios::binary);
+        std::string line;
+        time_t timestamp;
+        logfile.seekg(last.offset);
+        stale = !std::getline(logfile, line) || !parseLineTimestamp(line, timestamp) || timestamp != last.timestamp;
+    }
+
+    if (stale) {
+        if (ftruncate(this->indexfd, 0) == -1) {
+            return;
+        }
+        this->lastTimestamp = -1;
+        this->scan(logfilePath, 0);
+        return;
+    }
+
+    this->lastTimestamp = last.timestamp;
+    this->scan(logfilePath, last.offset);
+}
+
+/**
+ * Records that a line logged at `timestamp` starts at `offset`. Only the
+ * first line of each second makes it to the index. Entries are buffered
+ * until `flush()`.
+ *
+ * @param timestamp Time the line was logged at
+ * @param offset Offset of the line in the logfile
+ */
+void LogIndex::record(time_t timestamp, off_t offset) noexcept {
+    if (this->indexfd == -1 || timestamp <= this->lastTimestamp) {
+        return;
+    }
+
+    Entry entry = {static_cast<int64_t>(timestamp), static_cast<uint64_t>(offset)};
+    this->pending.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    this->lastTimestamp = timestamp;
+}
+
+/**
+ * Writes the buffered entries to the index file. Must be called after the
+ * lines they point to were written to the logfile.
+ */
+void LogIndex::flush(void) noexcept {
+    size_t written = 0;
+    while (this->indexfd != -1 && written < this->pending.size()) {
+        ssize_t wr = write(this->indexfd, this->pending.data() + written, this->pending.size() - written);
+        if (wr == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        written += static_cast<size_t>(wr);
+    }
+    this->pending.clear();
+}
+
+/**
+ * Looks up the byte range of the logfile holding the lines logged between
+ * `from` and `to` (inclusive), binary searching the index file so only the
+ * pages holding the probed entries are read.
+ *
+ * @param logfilePath Path of the indexed logfile
+ * @param from Start of the time range
+ * @param to End of the time range
+ * @param range Where to store the byte range
+ *
+ * @return Whether the lookup succeeded
+ */
+bool LogIndex::lookup(const std::string &logfilePath, time_t from, time_t to, LogRange &range) noexcept {
+    struct stat logStat;
+    if (stat(logfilePath.c_str(), &logStat) == -1) {
+        return false;
+    }
+
+    int indexfd = open((logfilePath + INDEX_SUFFIX).c_str(), O_RDONLY | O_CLOEXEC);
+    if (indexfd == -1) {
+        return false;
+    }
+
+    struct stat indexStat;
+    if (fstat(indexfd, &indexStat) == -1) {
+        close(indexfd);
+        return false;
+    }
+    const off_t nEntries = indexStat.st_size / sizeof(Entry);
+
+    // Offset of the first line logged at or after `timestamp`
+    bool ok = true;
+    auto lowerBound = [&](int64_t timestamp) -> off_t {
+        off_t lo = 0;
+        off_t hi = nEntries;
+        Entry entry;
+        while (lo < hi) {
+            off_t mid = lo + (hi - lo) / 2;
+            if (pread(indexfd, &entry, sizeof(entry), mid * sizeof(Entry)) != sizeof(entry)) {
+                ok = false;
+                return logStat.st_size;
+            }
+            if (entry.timestamp < timestamp) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        if (lo == nEntries || pread(indexfd, &entry, sizeof(entry), lo * sizeof(Entry)) != sizeof(entry)) {
+            return logStat.st_size;
+        }
+        return std::min(static_cast<off_t>(entry.offset), logStat.st_size);
+    };
+
+    range.begin = lowerBound(from);
+    if (to < from) {
+        range.end = range.begin;
+    } else if (to == std::numeric_limits<time_t>::max()) {
+        range.end = logStat.st_size;
+    } else {
+        range.end = lowerBound(static_cast<int64_t>(to) + 1);
+    }
+    if (range.end < range.begin) {
+        range.end = range.begin;
+    }
+
+    close(indexfd);
+    return ok;
+}
+
+/**
+ * Parses a timestamp given either as seconds since the Epoch or in the
+ * logfile's format (day/month/year hour:minute:second, local time).
+ *
+ * @param str String to parse
+ * @param timestamp Where to store the result
+ *
+ * @return Whether `str` is a valid timestamp
+ */
+bool LogIndex::parseTimestamp(const std::string &str, time_t &timestamp) noexcept {
+    if (str.empty()) {
+        return false;
+    }
+
+    if (str.find_first_not_of("0123456789") == std::string::npos) {
+        char *end = nullptr;
+        errno = 0;
+        long long seconds = std::strtoll(str.c_str(), &end, 10);
+        if (errno != 0 || *end != '\0') {
+            return false;
+        }
+        timestamp = static_cast<time_t>(seconds);
+        return true;
+    }
+
+    struct tm timeInfo = {};
+    const char *end = strptime(str.c_str(), Tintin_reporter::TIMESTAMP_FORMAT, &timeInfo);
+    if (end == nullptr || *end != '\0') {
+        return false;
+    }
+    timeInfo.tm_isdst = -1;
+    timestamp = mktime(&timeInfo);
+    return timestamp != -1;
+}
+
+/**
+ * Parses the timestamp of a logfile line, e.g.
+ * "[25/04/2025 03:05:54] [INFO] matt-daemon: started".
+ *
+ * @param line Logfile line
+ * @param timestamp Where to store the result
+ *
+ * @return Whether `line` starts with a valid timestamp
+ */
+bool LogIndex::parseLineTimestamp(const std::string &line, time_t &timestamp) noexcept {
+    if (line.empty() || line[0] != '[') {
+        return false;
+    }
+
+    struct tm timeInfo = {};
+    const char *end = strptime(line.c_str() + 1, Tintin_reporter::TIMESTAMP_FORMAT, &timeInfo);
+    if (end == nullptr || *end != ']') {
+        return false;
+    }
+    timeInfo.tm_isdst = -1;
+    timestamp = mktime(&timeInfo);
+    return timestamp != -1;
+}
+
+/**
+ * Parses the sequence number of a logfile line, only logged with --shards,
+ * e.g. "[25/04/2025 03:05:54] [#42] [LOG] matt-daemon: received message: hi".
+ *
+ * @param line Logfile line
+ * @param sequence Where to store the result
+ *
+ * @return Whether `line` has a sequence number after its timestamp
+ */
+bool LogIndex::parseLineSequence(const std::string &line, uint64_t &sequence) noexcept {
+    size_t start = line.find("] [#");
+    if (line.empty() || line[0] != '[' || start == std::string::npos || start != line.find(']')) {
+        return false;
+    }
+    start += 4;
+
+    size_t end = line.find_first_not_of("0123456789", start);
+    if (end == start || end == std::string::npos || line[end] != ']') {
+        return false;
+    }
+    errno = 0;
+    sequence = std::strtoull(line.c_str() + start, nullptr, 10);
+    return errno == 0;
+}
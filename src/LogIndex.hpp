@@ -0,0 +1,52 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+struct LogRange {
+    off_t begin;
+    off_t end;
+};
+
+/**
+ * Sparse sidecar index of a logfile, stored next to it as `<logfile>.idx`.
+ * Holds one fixed size entry per second that had at least one line logged,
+ * mapping that second to the offset of its first line, so time range
+ * queries can binary search the index and seek straight to the data.
+ */
+class LogIndex {
+    static constexpr const char *INDEX_SUFFIX = ".idx";
+
+    struct Entry {
+        int64_t timestamp;
+        uint64_t offset;
+    };
+
+    int indexfd;
+    std::string indexPath;
+    std::string pending;
+    time_t lastTimestamp;
+
+    bool readLastEntry(Entry &entry) const noexcept;
+    void scan(const std::string &logfilePath, off_t from) noexcept;
+
+public:
+    LogIndex(const std::string &logfilePath) noexcept;
+    LogIndex(const LogIndex &rhs) noexcept;
+    LogIndex &operator=(const LogIndex &rhs) noexcept;
+    ~LogIndex(void) noexcept;
+
+    bool isValid(void) const noexcept;
+
+    void catchUp(const std::string &logfilePath, off_t logSize) noexcept;
+    void record(time_t timestamp, off_t offset) noexcept;
+    void flush(void) noexcept;
+
+    static bool lookup(const std::string &logfilePath, time_t from, time_t to, LogRange &range) noexcept;
+    static bool parseTimestamp(const std::string &str, time_t &timestamp) noexcept;
+    static bool parseLineTimestamp(const std::string &line, time_t &timestamp) noexcept;
+    static bool parseLineSequence(const std::string &line, uint64_t &sequence) noexcept;
+};
@@ -0,0 +1,86 @@
+#include "RecentRing.hpp"
+
+#include <algorithm>
+#include <string>
+
+RecentRing::RecentRing(void) noexcept : RecentRing(DEFAULT_MAX_RECORDS, DEFAULT_MAX_BYTES) {}
+
+RecentRing::RecentRing(size_t maxRecords, size_t maxBytes) noexcept {
+    this->maxRecords = maxRecords;
+    this->maxBytes = maxBytes;
+    this->bytes = 0;
+    this->firstSeq = 0;
+}
+
+RecentRing::RecentRing(const RecentRing &rhs) noexcept {
+    if (this != &rhs) {
+        *this = rhs;
+    }
+}
+
+RecentRing &RecentRing::operator=(const RecentRing &rhs) noexcept {
+    if (this != &rhs) {
+        this->records = rhs.records;
+        this->maxRecords = rhs.maxRecords;
+        this->maxBytes = rhs.maxBytes;
+        this->bytes = rhs.bytes;
+        this->firstSeq = rhs.firstSeq;
+    }
+    return *this;
+}
+
+RecentRing::~RecentRing(void) noexcept {}
+
+/**
+ * Appends a record, evicting the oldest ones until both the record and
+ * the byte budgets are respected. A record bigger than the whole byte
+ * budget is truncated to it, keeping its trailing newline so readers
+ * still see where it ends.
+ *
+ * @param record Record to append
+ */
+void RecentRing::push(const std::string &record) noexcept {
+    if (this->maxRecords == 0 || this->maxBytes == 0) {
+        this->firstSeq += 1;
+        return;
+    }
+
+    size_t size = std::min(record.size(), this->maxBytes);
+    while (!this->records.empty()
+           && (this->records.size() >= this->maxRecords || this->bytes + size > this->maxBytes)) {
+        this->bytes -= this->records.front().size();
+        this->records.pop_front();
+        this->firstSeq += 1;
+    }
+
+    if (size < record.size() && record.back() == '\n') {
+        this->records.emplace_back(record, 0, size - 1);
+        this->records.back().push_back('\n');
+    } else {
+        this->records.emplace_back(record, 0, size);
+    }
+    this->bytes += size;
+}
+
+/**
+ * @return Sequence number of the oldest record still held
+ */
+uint64_t RecentRing::beginSeq(void) const noexcept {
+    return this->firstSeq;
+}
+
+/**
+ * @return Sequence number the next record pushed will get
+ */
+uint64_t RecentRing::endSeq(void) const noexcept {
+    return this->firstSeq + this->records.size();
+}
+
+/**
+ * @param seq Sequence number, in [`beginSeq()`, `endSeq()`)
+ *
+ * @return The record with sequence number `seq`
+ */
+const std::string &RecentRing::at(uint64_t seq) const noexcept {
+    return this->records[seq - this->firstSeq];
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+
+/**
+ * Bounded in-memory history of the most recent log records. Bounded both
+ * in number of records and in bytes, the oldest records are evicted first.
+ * Every record gets a sequence number so readers can keep a cursor and
+ * tell how many records they missed if the ring moved past it.
+ */
+class RecentRing {
+    std::deque<std::string> records;
+    size_t maxRecords;
+    size_t maxBytes;
+    size_t bytes;
+    uint64_t firstSeq;
+
+public:
+    static constexpr size_t DEFAULT_MAX_RECORDS = 1000;
+    static constexpr size_t DEFAULT_MAX_BYTES = 1024 * 1024;
+
+    RecentRing(void) noexcept;
+    RecentRing(size_t maxRecords, size_t maxBytes) noexcept;
+    RecentRing(const RecentRing &rhs) noexcept;
+    RecentRing &operator=(const RecentRing &rhs) noexcept;
+    ~RecentRing(void) noexcept;
+
+    void push(const std::string &record) noexcept;
+
+    uint64_t beginSeq(void) const noexcept;
+    uint64_t endSeq(void) const noexcept;
+    const std::string &at(uint64_t seq) const noexcept;
+};
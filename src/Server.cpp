@@ -1,40 +1,115 @@
 #include "Server.hpp"
 
+#include <endian.h>
 #include <fcntl.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sched.h>
 #include <string.h>
 #include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <chrono>
 #include <csignal>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <vector>
 
+#include "LogIndex.hpp"
 #include "Tintin_reporter.hpp"
 #include "signal.hpp"
+#include "trace.hpp"
+
+#ifndef EPIOCSPARAMS
+// Busy poll settings of an epoll instance, from <linux/eventpoll.h> (Linux 6.9)
+struct epoll_params {
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A, 0x01, struct epoll_params)
+#endif
 
 extern std::unique_ptr<Tintin_reporter> g_logger;
 
-volatile sig_atomic_t g_run = 0;  // Global variable to control the server loop
+volatile sig_atomic_t g_run = 0;     // Global variable to control the server loop
+volatile sig_atomic_t g_reopen = 0;  // Set on SIGHUP, asks the server loop to reopen the logfile
+#if MATT_TRACE
+volatile sig_atomic_t g_dumpTrace = 0;  // Set on SIGUSR1, asks the server loop to log the latency trace
+#endif
+
+/**
+ * @return Bytes of output queued for a client, waiting for it to read them
+ */
+static size_t pendingOutput(const Client &client) noexcept {
+    return client.outbuf.size() + client.afterTransfer.size();
+}
+
+/**
+ * FNV-1a, used to route to shards: unlike `std::hash`, its low bits tell
+ * apart keys differing in a single byte, e.g. two consecutive addresses.
+ */
+static uint64_t hashBytes(const char *data, size_t size) noexcept {
+    uint64_t hash = 0xcbf29ce484222325;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3;
+    }
+    return hash;
+}
 
 /**
  * @throws `std::runtime_error`
  */
-Server::Server(void) {
+Server::Server(const Config &config) {
+    this->config = config;
+    this->bufferedBytes = 0;
+    this->readingPaused = false;
+    this->syncFailed = false;
+    this->nextClientId = 0;
+
+    // Sharded output: client messages go to their own logfiles, the main one keeps the daemon's own records
+    for (int k = 0; config.shards > 1 && k < config.shards; k++) {
+        this->shards.push_back(std::make_unique<ShardWriter>(Tintin_reporter::shardPath(g_logger->getPath(), k), config.durability, config.syncIntervalMs));
+        if (!this->shards.back()->isValid()) {
+            throw std::runtime_error("failed to open logfile of shard " + std::to_string(k));
+        }
+    }
+
 #ifdef _DEBUG
     std::cout << "Creating server's socket..." << std::endl;
 #endif
 
-    int socketfd = socket(AF_INET, SOCK_STREAM, 0);
+    int socketfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (socketfd == -1) {
         throw std::runtime_error(std::string("failed to create server's socket: socket() failed: ") + strerror(errno));
     }
     this->socketfd = socketfd;
 
+    // Spare fd, given up to turn connections away when out of fds (see handleNewConnection())
+    this->spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    // Don't fail to restart while connections of a previous run linger in TIME_WAIT
+    int enable = 1;
+    if (setsockopt(socketfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)) == -1) {
+        throw std::runtime_error(std::string("failed to set SO_REUSEADDR: setsockopt() failed: ") + strerror(errno));
+    }
+
+    // Accepted sockets inherit it, and it has to be set before listen() to be taken into account for the TCP window scale
+    if (config.rcvbuf > 0 && setsockopt(socketfd, SOL_SOCKET, SO_RCVBUF, &config.rcvbuf, sizeof(config.rcvbuf)) == -1) {
+        throw std::runtime_error(std::string("failed to set SO_RCVBUF: setsockopt() failed: ") + strerror(errno));
+    }
+
 #ifdef _DEBUG
     std::cout << "Binding socket to port " << std::to_string(Server::PORT) << "..." << std::endl;
 #endif
@@ -52,10 +127,16 @@ Server::Server(void) {
     std::cout << "Setting server's socket to listen..." << std::endl;
 #endif
 
-    if (listen(socketfd, MAX_CLIENTS) == -1) {
+    if (listen(socketfd, config.backlog) == -1) {
         throw std::runtime_error(std::string("failed to listen on port ") + std::to_string(Server::PORT) + ": " + strerror(errno));
     }
 
+    // Only get woken up for connections that already sent something
+    if (config.deferAcceptSecs > 0
+        && setsockopt(socketfd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &config.deferAcceptSecs, sizeof(config.deferAcceptSecs)) == -1) {
+        throw std::runtime_error(std::string("failed to set TCP_DEFER_ACCEPT: setsockopt() failed: ") + strerror(errno));
+    }
+
 #ifdef _DEBUG
     std::cout << "Creating epollfd..." << std::endl;
 #endif
@@ -66,6 +147,8 @@ Server::Server(void) {
     }
     this->epollfd = epollfd;
 
+    this->setBusyPoll();
+
 #ifdef _DEBUG
     std::cout << "Adding server's socket to polled fds..." << std::endl;
 #endif
@@ -77,6 +160,40 @@ Server::Server(void) {
     if (epoll_ctl(epollfd, EPOLL_CTL_ADD, socketfd, &ev) == -1) {
         throw std::runtime_error(std::string("failed to add server's socket fd to epoll()'s interest list: epoll_ctl() failed: ") + strerror(errno));
     }
+
+#ifdef _DEBUG
+    std::cout << "Creating admin socket..." << std::endl;
+#endif
+
+    int adminfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (adminfd == -1) {
+        throw std::runtime_error(std::string("failed to create admin socket: socket() failed: ") + strerror(errno));
+    }
+    this->adminfd = adminfd;
+
+    sockaddr_un adminAddress;
+    std::memset(&adminAddress, 0, sizeof(adminAddress));
+    adminAddress.sun_family = AF_UNIX;
+    std::strncpy(adminAddress.sun_path, Server::ADMIN_SOCKET_PATH, sizeof(adminAddress.sun_path) - 1);
+
+    // Left over by a previous run that didn't exit cleanly, we hold the instance lock
+    unlink(Server::ADMIN_SOCKET_PATH);
+    if (bind(adminfd, (struct sockaddr *)&adminAddress, sizeof(adminAddress)) == -1) {
+        throw std::runtime_error(std::string("failed to bind admin socket to ") + Server::ADMIN_SOCKET_PATH + ": " + strerror(errno));
+    }
+    // The logs can be read back through it, root only
+    if (chmod(Server::ADMIN_SOCKET_PATH, S_IRUSR | S_IWUSR) == -1) {
+        throw std::runtime_error(std::string("failed to restrict admin socket permissions: chmod() failed: ") + strerror(errno));
+    }
+    if (listen(adminfd, config.backlog) == -1) {
+        throw std::runtime_error(std::string("failed to listen on admin socket: listen() failed: ") + strerror(errno));
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = adminfd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, adminfd, &ev) == -1) {
+        throw std::runtime_error(std::string("failed to add admin socket fd to epoll()'s interest list: epoll_ctl() failed: ") + strerror(errno));
+    }
 }
 
 Server::Server(Server &rhs) noexcept {
@@ -87,10 +204,19 @@ Server::Server(Server &rhs) noexcept {
 
 Server &Server::operator=(Server &rhs) noexcept {
     if (this != &rhs) {
+        this->config = rhs.config;
         this->socketfd = rhs.socketfd;
+        this->adminfd = rhs.adminfd;
+        this->spareFd = rhs.spareFd;
         this->epollfd = rhs.epollfd;
         std::memcpy(this->events.data(), rhs.events.data(), sizeof(rhs.events));
         this->clients = std::move(rhs.clients);
+        this->bufferedBytes = rhs.bufferedBytes;
+        this->readingPaused = rhs.readingPaused;
+        this->holderProgress = rhs.holderProgress;
+        this->syncFailed = rhs.syncFailed;
+        this->shards = std::move(rhs.shards);
+        this->nextClientId = rhs.nextClientId;
     }
     return *this;
 }
@@ -98,49 +224,176 @@ Server &Server::operator=(Server &rhs) noexcept {
 Server::~Server(void) noexcept {
     close(this->epollfd);
     close(this->socketfd);
+    close(this->adminfd);
+    unlink(Server::ADMIN_SOCKET_PATH);
+    if (this->spareFd != -1) {
+        close(this->spareFd);
+    }
 
     for (const auto &it : clients) {
         close(it.get()->socketfd);
     }
 }
 
-void Server::handleNewConnection(void) noexcept {
+/**
+ * Low-latency mode: lets `epoll_wait()` busy poll the NAPI queues of the
+ * clients' sockets for up to `--busy-poll` microseconds before sleeping,
+ * preferring busy polling over softirq processing (`EPIOCSPARAMS`, Linux
+ * 6.9). Older kernels only busy poll from epoll through the
+ * `net.core.busy_poll` sysctl.
+ */
+void Server::setBusyPoll(void) noexcept {
+    if (this->config.busyPollUs <= 0) {
+        return;
+    }
+
+    struct epoll_params params;
+    memset(&params, 0, sizeof(params));
+    params.busy_poll_usecs = static_cast<uint32_t>(this->config.busyPollUs);
+    params.busy_poll_budget = Server::BUSY_POLL_BUDGET;
+    params.prefer_busy_poll = 1;
+    if (ioctl(this->epollfd, EPIOCSPARAMS, &params) == -1) {
+        g_logger->warn(std::string("failed to enable busy polling: ioctl(EPIOCSPARAMS) failed: ") + strerror(errno)
+                       + " (set the net.core.busy_poll sysctl instead)");
+    }
+}
+
+/**
+ * Waits for events on the polled fds. In low-latency mode, spins on
+ * non-blocking `epoll_wait()` calls for up to `--spin-us` microseconds
+ * first, so events arriving within that window don't pay for a sleep and
+ * a wakeup, at the cost of burning the CPU while spinning.
+ *
+ * @return `epoll_wait()`'s return value
+ */
+int Server::waitForEvents(void) noexcept {
+    // Shards' writer threads keep their own sync deadlines
+    int timeout = g_logger->pollTimeout();
+    if (this->readingPaused) {
+        // Wake up to resume paused clients if the others stall, see enforceMemoryBudget()
+        auto left = this->holderProgress + PAUSE_STALL_TIMEOUT - std::chrono::steady_clock::now();
+        int stallTimeout = std::max(0, static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(left).count()));
+        if (timeout == -1 || stallTimeout < timeout) {
+            timeout = stallTimeout;
+        }
+    }
+
+    if (this->config.spinUs > 0 && timeout != 0) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(this->config.spinUs);
+        do {
+            int nfds = epoll_wait(this->epollfd, this->events.data(), Server::MAX_EVENTS, 0);
+            if (nfds != 0) {
+                return nfds;
+            }
+        } while (g_run && std::chrono::steady_clock::now() < deadline);
+    }
+
+    return epoll_wait(this->epollfd, this->events.data(), Server::MAX_EVENTS, timeout);
+}
+
+/**
+ * Accepts every pending connection, until the backlog is drained, so a
+ * storm of (re)connecting clients is dealt with in a single wakeup.
+ * Connections over the clients limit are rejected, admin connections
+ * don't count towards it.
+ *
+ * @param listenfd Listening socket with pending connections, the
+ * server's or the admin one
+ */
+void Server::handleNewConnection(int listenfd) noexcept {
 #ifdef _DEBUG
-    std::cout << "Received event on server's socket, trying to accept client..." << std::endl;
+    std::cout << "Received event on server's socket, trying to accept clients..." << std::endl;
 #endif
 
-    // If event is on server's socket fd, accept new client
-    int clientSocketFd = accept(this->socketfd, nullptr, nullptr);
-    if (clientSocketFd == -1) {
-        g_logger->error(std::string("failed to accept client: accept() failed: ") + strerror(errno));
-        return;
-    }
+    int rejected = 0;
+    int outOfFds = 0;
+    // Counted once, not per accepted connection: storms would make draining the queue quadratic
+    int connected = std::count_if(this->clients.begin(), this->clients.end(), [](const std::unique_ptr<Client> &client) {
+        return !client->admin;
+    });
+
+    while (true) {
+        // Accepted sockets come out non-blocking already, no fcntl() needed
+        int clientSocketFd = accept4(listenfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocketFd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && this->spareFd != -1) {
+                // Out of fds: the pending connection would keep the server's socket readable
+                // forever, give up the spare fd to accept it and turn it away right away
+                close(this->spareFd);
+                clientSocketFd = accept4(listenfd, nullptr, nullptr, SOCK_CLOEXEC);
+                if (clientSocketFd != -1) {
+                    close(clientSocketFd);
+                    outOfFds += 1;
+                }
+                this->spareFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (clientSocketFd == -1) {
+                    // Nothing left to accept: accept4() runs out of fds before looking at the queue
+                    break;
+                }
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                g_logger->error(std::string("failed to accept client: accept4() failed: ") + strerror(errno));
+            }
+            break;
+        }
 
 #ifdef _DEBUG
-    std::cout << "Client accepted" << std::endl;
+        std::cout << "Client accepted" << std::endl;
 #endif
 
-    if (clients.size() == MAX_CLIENTS) {
-        if (send(clientSocketFd, CLIENT_REJECTED_MSG, sizeof(CLIENT_REJECTED_MSG), MSG_DONTWAIT) == -1) {
-            g_logger->warn(std::string("failed to send client rejected message: send() failed: ") + strerror(errno));
+        bool admin = listenfd == this->adminfd;
+        if (!admin && connected >= this->config.maxClients) {
+            this->rejectClient(clientSocketFd);
+            rejected += 1;
+            continue;
         }
 
-        close(clientSocketFd);
-        g_logger->notice("rejected client due to connections limit");
-        return;
+        if (this->registerClient(clientSocketFd, admin) && !admin) {
+            connected += 1;
+        }
     }
 
-    // Set client socket as non-blocking
-    int flags = fcntl(clientSocketFd, F_GETFL, 0);
-    if (flags == -1) {
-        close(clientSocketFd);
-        g_logger->error(std::string("failed to get client's socket options: fcntl() failed: ") + strerror(errno));
-        return;
+    if (rejected > 0) {
+        // One line per wakeup, not per client, storms would flood the logfile otherwise
+        g_logger->notice("rejected " + std::to_string(rejected) + " client(s) due to connections limit");
     }
-    if (fcntl(clientSocketFd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        close(clientSocketFd);
-        g_logger->error(std::string("failed to set client's socket as non-blocking: fcntl() failed: ") + strerror(errno));
-        return;
+    if (outOfFds > 0) {
+        g_logger->error("rejected " + std::to_string(outOfFds) + " client(s): out of file descriptors");
+    }
+}
+
+/**
+ * Turns away a connection over the clients limit. Never blocks: the
+ * socket is non-blocking, so if the message doesn't fit in the socket's
+ * buffer it's simply not sent.
+ */
+void Server::rejectClient(int clientSocketFd) noexcept {
+    if (send(clientSocketFd, CLIENT_REJECTED_MSG, sizeof(CLIENT_REJECTED_MSG), MSG_DONTWAIT | MSG_NOSIGNAL) == -1
+        && errno != EAGAIN && errno != EWOULDBLOCK) {
+        g_logger->warn(std::string("failed to send client rejected message: send() failed: ") + strerror(errno));
+    }
+    close(clientSocketFd);
+}
+
+/**
+ * Applies the per-connection socket options and adds an accepted client
+ * to the polled fds.
+ *
+ * @param clientSocketFd Accepted socket
+ * @param admin Whether it came from the admin socket
+ *
+ * @return Whether the client was registered, its socket is closed otherwise
+ */
+bool Server::registerClient(int clientSocketFd, bool admin) noexcept {
+    if (this->config.tcpNodelay && !admin) {
+        int enable = 1;
+        if (setsockopt(clientSocketFd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable)) == -1) {
+            g_logger->warn(std::string("failed to set TCP_NODELAY on client's socket: setsockopt() failed: ") + strerror(errno));
+        }
     }
 
     // Add new client's socket to the polled fds
@@ -150,24 +403,92 @@ void Server::handleNewConnection(void) noexcept {
     if (epoll_ctl(this->epollfd, EPOLL_CTL_ADD, clientSocketFd, &ev) == -1) {
         close(clientSocketFd);
         g_logger->error(std::string("failed to add client's socket to epoll()'s interest list: epoll_ctl() failed: ") + strerror(errno));
-        return;
+        return false;
     }
 
     this->clients.push_back(std::make_unique<Client>(clientSocketFd));
+    this->clients.back()->events = EPOLLIN;
+    this->clients.back()->admin = admin;
+
+    if (!this->shards.empty() && !admin) {
+        uint64_t key = this->nextClientId++;
+        sockaddr_in peerAddress;
+        socklen_t peerAddressLen = sizeof(peerAddress);
+        if (this->config.shardBy == ShardBy::ADDR
+            && getpeername(clientSocketFd, reinterpret_cast<struct sockaddr *>(&peerAddress), &peerAddressLen) == 0) {
+            key = hashBytes(reinterpret_cast<const char *>(&peerAddress.sin_addr), sizeof(peerAddress.sin_addr));
+        }
+        this->clients.back()->shard = key % this->shards.size();
+    }
 
 #ifdef _DEBUG
     std::cout << "New client registered, socketfd=" << this->clients.back()->socketfd << std::endl;
 #endif
+    return true;
 }
 
-void Server::handleClientMsg(int clientFd) noexcept {
-    // Find the client associated with this fd
-    auto clientIt = std::find_if(
+/**
+ * @return Iterator to the client owning `clientFd`, or `clients.end()`
+ */
+std::vector<std::unique_ptr<Client>>::iterator Server::findClient(int clientFd) noexcept {
+    return std::find_if(
         this->clients.begin(),
         this->clients.end(),
         [clientFd](const std::unique_ptr<Client> &client) { return client->socketfd == clientFd; });
+}
+
+/**
+ * Removes a client from the polled fds and drops it.
+ */
+void Server::disconnectClient(std::vector<std::unique_ptr<Client>>::iterator clientIt) noexcept {
+    int clientFd = (*clientIt)->socketfd;
+    if (epoll_ctl(this->epollfd, EPOLL_CTL_DEL, clientFd, nullptr) == -1) {
+        g_logger->error(std::string("failed to remove client socket from epoll()'s interest list: epoll_ctl() failed: ") + strerror(errno));
+    }
 
-    char buf[RECV_BUFFER_SIZE] = {0};
+    close(clientFd);
+    this->bufferedBytes -= (*clientIt)->msg.size();
+    this->clients.erase(clientIt);
+}
+
+/**
+ * Updates the events polled for a client: no reads while a transfer is in
+ * progress (its output owns the connection), and writes only while there
+ * is output waiting for the socket to drain.
+ */
+void Server::updateInterest(Client &client) noexcept {
+    bool transferring = client.transferFd != -1;
+
+    // Paused clients are left unread, backpressure piles up in their socket buffers
+    bool reading = !transferring && !client.paused && pendingOutput(client) < OUTBUF_PAUSE_SIZE;
+
+    uint32_t events = reading ? static_cast<uint32_t>(EPOLLIN) : 0;
+    if (transferring || !client.outbuf.empty()) {
+        events |= EPOLLOUT;
+    }
+
+    if (events == client.events) {
+        return;
+    }
+
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.fd = client.socketfd;
+    if (epoll_ctl(this->epollfd, EPOLL_CTL_MOD, client.socketfd, &ev) == -1) {
+        g_logger->error(std::string("failed to update client's polled events: epoll_ctl() failed: ") + strerror(errno));
+        return;
+    }
+    client.events = events;
+}
+
+void Server::handleClientMsg(int clientFd) noexcept {
+    // Find the client associated with this fd
+    auto clientIt = this->findClient(clientFd);
+    if (clientIt == this->clients.end()) {
+        return;
+    }
+
+    char buf[RECV_BUFFER_SIZE];
     ssize_t rd = recv(clientFd, buf, sizeof(buf), MSG_DONTWAIT);
     if (rd == -1) {
         if (errno != EAGAIN && errno != EWOULDBLOCK) {
@@ -179,61 +500,1057 @@ void Server::handleClientMsg(int clientFd) noexcept {
         std::cout << "Client socketfd=" << clientFd << " closed the connection" << std::endl;
 #endif
         g_logger->info("peer has shutdown the connection");
-        if (epoll_ctl(this->epollfd, EPOLL_CTL_DEL, clientFd, nullptr) == -1) {
-            g_logger->error(std::string("failed to remove client socket from epoll()'s interest list: epoll_ctl() failed: ") + strerror(errno));
+        this->disconnectClient(clientIt);
+        return;
+    }
+
+#if MATT_TRACE
+    // Lines or frames spanning several reads were received at their first one
+    (*clientIt)->traceLastRecv = traceNow();
+    if ((*clientIt)->msg.empty()) {
+        (*clientIt)->traceRecv = (*clientIt)->traceLastRecv;
+    }
+#endif
+    if (!(*clientIt)->msg.empty()) {
+        this->holderProgress = std::chrono::steady_clock::now();
+    }
+    this->bufferedBytes += rd;
+    (*clientIt)->msg.append(buf, rd);
+
+    this->handleInput(clientIt);
+}
+
+/**
+ * Processes the input buffered for a client (see `processInput()`) and,
+ * unless on `Durability::GROUP`, sends the ACKs it earned.
+ *
+ * @return Whether the client was kept, it's disconnected otherwise
+ */
+bool Server::handleInput(std::vector<std::unique_ptr<Client>>::iterator clientIt) noexcept {
+    size_t buffered = (*clientIt)->msg.size();
+    bool keep = this->processInput(**clientIt);
+    this->bufferedBytes = this->bufferedBytes - buffered + (*clientIt)->msg.size();
+    if (!keep) {
+        this->disconnectClient(clientIt);
+        return false;
+    }
+
+    if (g_logger->getDurability() != Durability::GROUP) {
+        this->flushAcks(**clientIt);
+    }
+    return true;
+}
+
+/**
+ * Handles every complete unit of input received from a client so far
+ * (lines in text mode, frames in binary mode), leaving any incomplete
+ * trailing one in `client.msg`. The ACKs they earn are accumulated on the
+ * client, to be sent all at once by `flushAcks()`. A trailing line already
+ * longer than --max-line is spilled right away (see `spillPartial()`).
+ *
+ * Stops early while the client isn't reading its output, or while a file
+ * transfer is in progress: whatever is left waits in `client.msg` until
+ * `handleClientWritable()` drains the output, so pipelined commands can't
+ * pile up replies in memory, nor get their replies sent out of order
+ * around the transfer.
+ *
+ * @return Whether the client should be kept, false on protocol errors or
+ * lines too long with --oversize=disconnect
+ */
+bool Server::processInput(Client &client) noexcept {
+    size_t pos = 0;
+    bool stalled = false;
+
+    while (pos < client.msg.size()) {
+        if (pendingOutput(client) >= OUTBUF_PAUSE_SIZE || client.transferFd != -1) {
+            stalled = true;
+            break;
+        }
+
+        if (client.protocol == Protocol::BINARY) {
+            if (client.msg.size() - pos < FRAME_LENGTH_SIZE) {
+                break;
+            }
+
+            uint32_t frameSize;
+            std::memcpy(&frameSize, client.msg.data() + pos, sizeof(frameSize));
+            frameSize = be32toh(frameSize);
+            if (frameSize > MAX_FRAME_SIZE) {
+                g_logger->warn("dropping client: frame of " + std::to_string(frameSize) + " bytes exceeds the maximum frame size");
+                return false;
+            }
+            if (client.msg.size() - pos - FRAME_LENGTH_SIZE < frameSize) {
+                break;
+            }
+
+            if (!this->handleFrame(client, client.msg.data() + pos + FRAME_LENGTH_SIZE, frameSize)) {
+                return false;
+            }
+            pos += FRAME_LENGTH_SIZE + frameSize;
+#if MATT_TRACE
+            // The next frame starts in the latest read
+            client.traceRecv = client.traceLastRecv;
+#endif
+            continue;
+        }
+
+        size_t newline = client.msg.find('\n', pos);
+        if (newline == std::string::npos) {
+            break;
+        }
+        std::string line = client.msg.substr(pos, newline - pos);
+        pos = newline + 1;
+#if MATT_TRACE
+        uint64_t recvTime = client.traceRecv;
+        uint64_t frameTime = traceNow();
+        // The next line starts in the latest read
+        client.traceRecv = client.traceLastRecv;
+#endif
+
+        if (client.admin) {
+            // Admin connections only carry commands, never logged nor acknowledged
+            this->handleAdminCommand(client, line);
+            continue;
+        }
+
+        if (client.oversized) {
+            // End of a line that went over --max-line, its beginning was already spilled
+            client.oversized = false;
+            if (this->config.oversize == Oversize::SPLIT && !line.empty()) {
+                this->logMessage(client, line.data(), line.size());
+            }
+        } else {
+            bool keep = true;
+            if (this->handleCommand(client, line, keep)) {
+                if (!keep) {
+                    return false;
+                }
+                continue;
+            }
+
+            // If message has text, log it
+            if (!line.empty() && !this->logMessage(client, line.data(), line.size())) {
+                return false;
+            }
         }
+        // ACK is held back until flushAcks(), on Durability::GROUP until the line is durable, see commit()
+        client.pendingAcks += 1;
+#if MATT_TRACE
+        client.traceSamples.push_back({recvTime, frameTime, traceNow()});
+#endif
+    }
+
+    client.msg.erase(0, pos);
+    if (!stalled && client.protocol == Protocol::TEXT && (client.oversized || client.msg.size() > this->config.maxLine)) {
+        return this->spillPartial(client, false);
+    }
+    return true;
+}
+
+/**
+ * Handles a binary protocol frame: logs every message of its batch and
+ * records the sequence number of the last one as the next cumulative ACK.
+ * Messages may contain any byte, backslashes and line breaks are escaped
+ * so every message still takes a single line of the logfile.
+ *
+ * @param client Client that sent the frame
+ * @param payload Frame payload
+ * @param size Frame payload size
+ *
+ * @return Whether the client should be kept, false if the frame is malformed
+ * or holds a message too long with --oversize=disconnect
+ */
+bool Server::handleFrame(Client &client, const char *payload, size_t size) noexcept {
+    if (size < BATCH_HEADER_SIZE) {
+        g_logger->warn("dropping client: malformed frame");
+        return false;
+    }
+
+    uint64_t seq;
+    uint32_t count;
+    std::memcpy(&seq, payload, sizeof(seq));
+    std::memcpy(&count, payload + sizeof(seq), sizeof(count));
+    seq = be64toh(seq);
+    count = be32toh(count);
+
+    // Validate the whole batch before logging any of it
+    size_t pos = BATCH_HEADER_SIZE;
+    bool wellFormed = true;
+    for (uint32_t i = 0; i < count && wellFormed; i++) {
+        uint32_t msgSize;
+        if (size - pos < sizeof(msgSize)) {
+            wellFormed = false;
+            break;
+        }
+        std::memcpy(&msgSize, payload + pos, sizeof(msgSize));
+        msgSize = be32toh(msgSize);
+        wellFormed = size - pos - sizeof(msgSize) >= msgSize;
+        pos += sizeof(msgSize) + msgSize;
+    }
+    if (!wellFormed || pos != size) {
+        g_logger->warn("dropping client: malformed frame");
+        return false;
+    }
 
-        close(clientIt->get()->socketfd);
-        this->clients.erase(clientIt);
+#if MATT_TRACE
+    uint64_t frameTime = traceNow();
+#endif
+
+    pos = BATCH_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t msgSize;
+        std::memcpy(&msgSize, payload + pos, sizeof(msgSize));
+        msgSize = be32toh(msgSize);
+        pos += sizeof(msgSize);
+
+        // Empty messages are acknowledged but not logged, as empty lines are in text mode
+        if (msgSize > 0 && !this->logMessage(client, payload + pos, msgSize)) {
+            return false;
+        }
+        pos += msgSize;
+#if MATT_TRACE
+        client.traceSamples.push_back({client.traceRecv, frameTime, traceNow()});
+#endif
+    }
+
+    if (count > 0) {
+        client.ackSeq = seq + count - 1;
+        client.ackSeqPending = true;
+    }
+    return true;
+}
+
+/**
+ * Only called when sharded.
+ *
+ * @return The shard a message from `client` goes to: the client's shard
+ * (or the message's, with --shard-by=hash)
+ */
+ShardWriter &Server::shardFor(const Client &client, const char *data, size_t size) noexcept {
+    if (this->config.shardBy == ShardBy::HASH) {
+        return *this->shards[hashBytes(data, size) % this->shards.size()];
+    }
+    return *this->shards[client.shard];
+}
+
+/**
+ * Logs a message received from a client, escaping backslashes and line
+ * breaks on the binary protocol. Messages longer than --max-line are
+ * truncated or split according to --oversize.
+ *
+ * @param client Client that sent the message
+ * @param data Message
+ * @param size Message size
+ *
+ * @return Whether the client should be kept, false if the message is too
+ * long with --oversize=disconnect
+ */
+bool Server::logMessage(const Client &client, const char *data, size_t size) noexcept {
+    const size_t maxLine = this->config.maxLine;
+
+    if (size > maxLine) {
+        switch (this->config.oversize) {
+            case Oversize::TRUNCATE:
+                g_logger->warn("truncated a message of " + std::to_string(size) + " bytes to " + std::to_string(maxLine));
+                size = maxLine;
+                break;
+            case Oversize::SPLIT:
+                g_logger->warn("split a message of " + std::to_string(size) + " bytes in chunks of " + std::to_string(maxLine));
+                for (size_t pos = 0; pos < size; pos += maxLine) {
+                    this->logMessage(client, data + pos, std::min(maxLine, size - pos));
+                }
+                return true;
+            case Oversize::DISCONNECT:
+                g_logger->warn("dropping client: message of " + std::to_string(size) + " bytes exceeds " + std::to_string(maxLine));
+                return false;
+        }
+    }
+
+    std::string msg("received message: ");
+    if (client.protocol == Protocol::TEXT) {
+        msg.append(data, size);
+    } else {
+        for (const char *c = data; c < data + size; c++) {
+            if (*c == '\\') {
+                msg.append("\\\\");
+            } else if (*c == '\n') {
+                msg.append("\\n");
+            } else if (*c == '\r') {
+                msg.append("\\r");
+            } else {
+                msg.push_back(*c);
+            }
+        }
+    }
+    if (this->shards.empty()) {
+        g_logger->log(msg);
+    } else {
+        time_t timestamp;
+        std::string line = g_logger->record(LogLevel::LOG, msg, timestamp);
+        this->shardFor(client, data, size).log(timestamp, line);
+    }
+    return true;
+}
+
+/**
+ * Gets rid of the partial line buffered for a client, applying --oversize
+ * to it as if it had gone over --max-line: truncate logs it and drops the
+ * rest of the line as it comes, split logs it as a chunk of the line. The
+ * client is marked as `oversized` until the line ends.
+ *
+ * @param client Client whose partial line to spill
+ * @param force Whether to spill all of it, to free memory (see
+ * `enforceMemoryBudget()`), rather than only what's over --max-line
+ *
+ * @return Whether the client should be kept, false with
+ * --oversize=disconnect and for partial binary frames, which can't be cut
+ */
+bool Server::spillPartial(Client &client, bool force) noexcept {
+    const size_t maxLine = this->config.maxLine;
+    const std::string reason = force ? "to stay within the memory budget" : "longer than " + std::to_string(maxLine) + " bytes";
+
+    if (client.protocol == Protocol::BINARY) {
+        g_logger->warn("dropping client: partial frame of " + std::to_string(client.msg.size()) + " bytes over the memory budget");
+        return false;
+    }
+    if (client.admin) {
+        // Commands are never logged
+        g_logger->warn("dropping admin client: partial command " + reason);
+        return false;
+    }
+
+    switch (this->config.oversize) {
+        case Oversize::TRUNCATE:
+            if (!client.oversized) {
+                g_logger->warn("truncated a line " + reason);
+                this->logMessage(client, client.msg.data(), std::min(client.msg.size(), maxLine));
+            }
+            client.msg.clear();
+            break;
+        case Oversize::SPLIT: {
+            if (!client.oversized) {
+                g_logger->warn("split a line " + reason);
+            }
+            // Without force, keep the last chunk: the line may end with it
+            size_t keep = force ? 0 : maxLine;
+            size_t pos = 0;
+            while (client.msg.size() - pos > keep) {
+                size_t chunk = std::min(maxLine, client.msg.size() - pos);
+                this->logMessage(client, client.msg.data() + pos, chunk);
+                pos += chunk;
+            }
+            client.msg.erase(0, pos);
+            break;
+        }
+        case Oversize::DISCONNECT:
+            g_logger->warn("dropping client: line " + reason);
+            return false;
+    }
+
+    client.oversized = true;
+    return true;
+}
+
+/**
+ * Keeps the partial lines and frames buffered for all clients, plus the
+ * output waiting for them to read it, within --mem-budget, checked once
+ * per event loop iteration. Over budget, the biggest are spilled (see
+ * `spillPartial()`) until it fits again, output can't be: clients not
+ * reading theirs are dropped. Past three quarters of it, reading is paused
+ * for every client holding partial data but the one holding the least,
+ * which is the likeliest to complete its line and free memory. Paused
+ * clients resume once usage is back to half the budget, or when no client
+ * left reading holds any partial data or reads any more of it for
+ * `PAUSE_STALL_TIMEOUT`, as usage can't go down by itself anymore.
+ */
+void Server::enforceMemoryBudget(void) noexcept {
+    const size_t budget = this->config.memBudget;
+
+    size_t outputBytes = 0;
+    for (const auto &client : this->clients) {
+        outputBytes += pendingOutput(*client);
+    }
+
+    while (this->bufferedBytes + outputBytes > budget) {
+        auto biggest = std::max_element(this->clients.begin(), this->clients.end(), [](const auto &a, const auto &b) {
+            return a->msg.size() + pendingOutput(*a) < b->msg.size() + pendingOutput(*b);
+        });
+        if (biggest == this->clients.end()) {
+            break;
+        }
+
+        // Input held back by unread output (see processInput()) isn't a partial line either
+        size_t output = pendingOutput(**biggest);
+        if ((*biggest)->msg.empty() || output >= OUTBUF_PAUSE_SIZE) {
+            if (output == 0) {
+                break;
+            }
+            g_logger->warn("dropping client: " + std::to_string(output) + " bytes of unread output over the memory budget");
+            outputBytes -= output;
+            this->disconnectClient(biggest);
+            continue;
+        }
+
+        size_t buffered = (*biggest)->msg.size();
+        bool keep = this->spillPartial(**biggest, true);
+        this->bufferedBytes = this->bufferedBytes - buffered + (*biggest)->msg.size();
+        if (!keep) {
+            this->disconnectClient(biggest);
+            continue;
+        }
+        (*biggest)->paused = false;
+        this->updateInterest(**biggest);
+    }
+
+    std::vector<Client *> holders;
+    bool anyPaused = false;
+    for (const auto &client : this->clients) {
+        anyPaused = anyPaused || client->paused;
+        if (!client->paused && !client->msg.empty()) {
+            holders.push_back(client.get());
+        }
+    }
+
+    size_t used = this->bufferedBytes + outputBytes;
+    if (used > budget / 4 * 3 && holders.size() > 1) {
+        auto smallest = std::min_element(holders.begin(), holders.end(), [](const Client *a, const Client *b) {
+            return a->msg.size() < b->msg.size();
+        });
+        for (Client *client : holders) {
+            if (client != *smallest) {
+                client->paused = true;
+                this->updateInterest(*client);
+            }
+        }
+        this->readingPaused = true;
+        this->holderProgress = std::chrono::steady_clock::now();
+        g_logger->warn("memory budget " + std::to_string(used * 100 / budget) + "% full: paused reading from " + std::to_string(holders.size() - 1) + " client(s)");
         return;
     }
 
-    std::string msg(buf);
-    if (msg == "quit\n") {
+    if (anyPaused
+        && (used <= budget / 2 || holders.empty()
+            || std::chrono::steady_clock::now() - this->holderProgress >= PAUSE_STALL_TIMEOUT)) {
+        for (const auto &client : this->clients) {
+            if (client->paused) {
+                client->paused = false;
+                this->updateInterest(*client);
+            }
+        }
+        anyPaused = false;
+    }
+    this->readingPaused = anyPaused;
+}
+
+/**
+ * Drains a client's pending output: queued bytes first, then the file
+ * transfer in progress (if any), one chunk at a time until the socket
+ * would block, and then whatever was queued while it was in progress.
+ * Once drained, handles the input left waiting on it, see `processInput()`.
+ */
+void Server::handleClientWritable(int clientFd) noexcept {
+    auto clientIt = this->findClient(clientFd);
+    if (clientIt == this->clients.end()) {
+        return;
+    }
+    Client &client = **clientIt;
+
+    while (true) {
+        if (!client.outbuf.empty()) {
+            ssize_t sent = send(clientFd, client.outbuf.data(), client.outbuf.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (sent == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return;
+                }
+                g_logger->warn(std::string("send() failed, dropping client: ") + strerror(errno));
+                this->disconnectClient(clientIt);
+                return;
+            }
+            client.outbuf.erase(0, sent);
+            continue;
+        }
+
+        if (client.transferFd == -1) {
+            break;
+        }
+        if (client.transferOffset >= client.transferEnd) {
+            close(client.transferFd);
+            client.transferFd = -1;
+            if (!client.nextTransfers.empty()) {
+                Transfer next = client.nextTransfers.front();
+                client.nextTransfers.erase(client.nextTransfers.begin());
+                client.transferFd = next.fd;
+                client.transferOffset = next.begin;
+                client.transferEnd = next.end;
+                continue;
+            }
+            client.outbuf = std::move(client.afterTransfer);
+            client.afterTransfer.clear();
+            continue;
+        }
+
+        // Straight from the page cache to the socket, advances transferOffset
+        off_t chunkSize = std::min(TRANSFER_CHUNK_SIZE, client.transferEnd - client.transferOffset);
+        ssize_t sent = sendfile(clientFd, client.transferFd, &client.transferOffset, chunkSize);
+        if (sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            g_logger->warn(std::string("sendfile() failed, dropping client: ") + strerror(errno));
+            this->disconnectClient(clientIt);
+            return;
+        }
+        if (sent == 0) {
+            // The file shrunk under us (rotated or truncated), nothing more to send
+            g_logger->warn("transfer ended early: logfile is shorter than expected");
+            this->disconnectClient(clientIt);
+            return;
+        }
+    }
+
+    if (!client.msg.empty() && !this->handleInput(clientIt)) {
+        return;
+    }
+
+    if (client.following) {
+        this->pumpFollower(client);
+    }
+    this->updateInterest(client);
+}
+
+/**
+ * Handles the protocol commands a client can send instead of a message:
+ * - `binary`: switch the connection to the binary protocol, answered with
+ * `BINARY` (see `handleFrame()`);
+ * - `quit`: stop the daemon.
+ *
+ * @param client Client that sent the line
+ * @param line Line received, without its newline
+ * @param keep Set to false if the client has to be dropped
+ *
+ * @return Whether `line` was a command
+ */
+bool Server::handleCommand(Client &client, const std::string &line, bool &keep) noexcept {
+    std::string command = line.substr(0, line.find(' '));
+    std::string args = command.size() < line.size() ? line.substr(command.size() + 1) : "";
+
+    if (command == "quit" && args.empty()) {
         g_logger->info("received quit request");
         g_run = 0;
+        return true;
+    } else if (command == "binary" && args.empty()) {
+        // Text ACKs can't be sent once in binary mode: the ones still held back go
+        // before BINARY, once durable on group commit
+        if (client.pendingAcks > 0 && g_logger->getDurability() == Durability::GROUP) {
+            if (!this->syncFailed && !this->syncLogs()) {
+                g_logger->error(std::string("failed to sync logfile: ") + strerror(errno));
+                this->syncFailed = true;
+            }
+            if (this->syncFailed) {
+                // Its lines may be lost, see commit()
+                g_logger->warn("dropping client: its lines could not be synced");
+                keep = false;
+                return true;
+            }
+        }
+        this->flushAcks(client);
+        client.protocol = Protocol::BINARY;
+        this->queueSend(client, BINARY_MSG);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Handles a command received on the admin socket, answered with `ERROR`
+ * if it isn't one:
+ * - `query <from> <to>`: stream the logfile lines logged between `from`
+ * and `to` (seconds since the Epoch), see `handleQuery()`;
+ * - `fetch <offset> [<file>]`: stream a logfile from byte `offset` on, see
+ * `handleFetch()`;
+ * - `tail <n>`: send the last `n` log records, from memory, see `handleTail()`;
+ * - `follow`/`unfollow`: start/stop streaming new log records as they are
+ * logged, see `pumpFollower()`;
+ * - `stats`: log the latency trace percentiles (if built with tracing),
+ * answered with `STATS`.
+ *
+ * @param client Admin client that sent the line
+ * @param line Line received, without its newline
+ */
+void Server::handleAdminCommand(Client &client, const std::string &line) noexcept {
+    std::string command = line.substr(0, line.find(' '));
+    std::string args = command.size() < line.size() ? line.substr(command.size() + 1) : "";
+
+    if (command == "query") {
+        this->handleQuery(client, args);
+    } else if (command == "fetch") {
+        this->handleFetch(client, args);
+    } else if (command == "tail") {
+        this->handleTail(client, args);
+    } else if (command == "follow" && args.empty()) {
+        client.following = true;
+        client.followSeq = g_logger->getRecent().endSeq();
+        this->queueSend(client, "FOLLOW\n");
+    } else if (command == "unfollow" && args.empty()) {
+        client.following = false;
+        this->queueSend(client, "UNFOLLOW\n");
+    } else if (command == "stats" && args.empty()) {
+#if MATT_TRACE
+        traceDump();
+#else
+        g_logger->info("latency tracing is disabled in this build");
+#endif
+        this->queueSend(client, "STATS\n");
+    } else {
+        this->queueSend(client, "ERROR unknown command: " + command + "\n");
+    }
+}
+
+/**
+ * Answers a `query <from> <to>` command with a `QUERY <size>` header
+ * followed by the `size` bytes of the logfile holding the lines logged
+ * between `from` and `to`, looked up on the logfile's index. With shards,
+ * the lines of every shard's logfile follow the main logfile's, each
+ * looked up on its own index. The data is streamed as the socket drains,
+ * without blocking other clients.
+ *
+ * @param client Client that sent the query
+ * @param args Command arguments
+ */
+void Server::handleQuery(Client &client, const std::string &args) noexcept {
+    std::istringstream argStream(args);
+    std::string fromStr;
+    std::string toStr;
+    std::string extra;
+    time_t from;
+    time_t to;
+    if (!(argStream >> fromStr >> toStr) || (argStream >> extra)
+        || !LogIndex::parseTimestamp(fromStr, from) || !LogIndex::parseTimestamp(toStr, to)) {
+        this->queueSend(client, "ERROR usage: query <from> <to>\n");
         return;
     }
 
-    (*clientIt)->msg.append(msg);
+    this->flushLogs();
 
-    if ((*clientIt)->msg.back() == '\n') {
-        // Delete newline
-        (*clientIt)->msg.pop_back();
+    // With shards, every shard's index has its part of the range
+    std::vector<std::string> paths{g_logger->getPath()};
+    for (size_t k = 0; k < this->shards.size(); k++) {
+        paths.push_back(Tintin_reporter::shardPath(g_logger->getPath(), static_cast<int>(k)));
+    }
 
-        if (!(*clientIt)->msg.empty()) {
-            // If message has text, log it
-            g_logger->log(std::string("received message: ") + (*clientIt)->msg);
-            (*clientIt)->msg.clear();
+    std::vector<Transfer> transfers;
+    off_t size = 0;
+    std::string error;
+    for (const std::string &path : paths) {
+        LogRange range;
+        if (!LogIndex::lookup(path, from, to, range)) {
+            error = "ERROR failed to look up the logfile index\n";
+            break;
+        }
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            g_logger->error(std::string("failed to open logfile for query: open() failed: ") + strerror(errno));
+            error = "ERROR failed to open the logfile\n";
+            break;
+        }
+        transfers.push_back({fd, range.begin, range.end});
+        size += range.end - range.begin;
+    }
+    if (!error.empty()) {
+        for (const Transfer &transfer : transfers) {
+            close(transfer.fd);
+        }
+        this->queueSend(client, error);
+        return;
+    }
+
+    g_logger->info("serving query for " + std::to_string(size) + " bytes");
+    this->queueSend(client, "QUERY " + std::to_string(size) + "\n");
+    for (const Transfer &transfer : transfers) {
+        this->startTransfer(client, transfer.fd, transfer.begin, transfer.end);
+    }
+}
+
+/**
+ * Answers a `fetch <offset> [<file>]` command with a `FETCH <size>` header
+ * followed by the `size` bytes of the logfile from `offset` to its current
+ * end. `file` is the name of a logfile in the logfile directory: the main
+ * one by default, a shard's or a rotated segment (e.g. matt_daemon.log.1).
+ * A client that got disconnected resumes by fetching again from `offset` +
+ * what it received. The data goes from the page cache to the socket with
+ * `sendfile()` as the socket drains, without blocking other clients.
+ *
+ * @param client Client that sent the command
+ * @param args Command arguments
+ */
+void Server::handleFetch(Client &client, const std::string &args) noexcept {
+    const std::string &logfilePath = g_logger->getPath();
+    const std::string logDir = logfilePath.substr(0, logfilePath.rfind('/') + 1);
+    const std::string logName = logfilePath.substr(logDir.size());
+    const std::string logStem = logName.substr(0, logName.rfind(".log"));
+
+    std::istringstream argStream(args);
+    std::string offsetStr;
+    std::string file = logName;
+    std::string extra;
+    off_t offset = 0;
+    if (argStream >> offsetStr && offsetStr.find_first_not_of("0123456789") == std::string::npos) {
+        errno = 0;
+        offset = static_cast<off_t>(std::strtoll(offsetStr.c_str(), nullptr, 10));
+    }
+    if (offsetStr.empty() || offsetStr.find_first_not_of("0123456789") != std::string::npos || errno != 0
+        || (argStream >> file && argStream >> extra)) {
+        this->queueSend(client, "ERROR usage: fetch <offset> [<file>]\n");
+        return;
+    }
+
+    // Only logfiles, never the indexes nor anything outside the logfile directory
+    if (file.find('/') != std::string::npos || file.rfind(logStem + ".", 0) != 0
+        || (file.size() >= 4 && file.compare(file.size() - 4, 4, ".idx") == 0)) {
+        this->queueSend(client, "ERROR not a logfile: " + file + "\n");
+        return;
+    }
+
+    this->flushLogs();
+
+    int fd = open((logDir + file).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        this->queueSend(client, "ERROR failed to open " + file + ": " + strerror(errno) + "\n");
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        this->queueSend(client, "ERROR failed to stat " + file + ": " + strerror(errno) + "\n");
+        return;
+    }
+    if (offset > st.st_size) {
+        close(fd);
+        this->queueSend(client, "ERROR offset past the end of " + file + "\n");
+        return;
+    }
+
+    g_logger->info("serving fetch of " + std::to_string(st.st_size - offset) + " bytes of " + file + " from offset " + std::to_string(offset));
+    this->queueSend(client, "FETCH " + std::to_string(st.st_size - offset) + "\n");
+    this->startTransfer(client, fd, offset, st.st_size);
+}
+
+/**
+ * Answers a `tail <n>` command with a `TAIL <size>` header followed by the
+ * `size` bytes of the last `n` log records (or less, if fewer are held in
+ * memory). Served from memory, the logfile isn't touched.
+ *
+ * @param client Client that sent the command
+ * @param args Command arguments
+ */
+void Server::handleTail(Client &client, const std::string &args) noexcept {
+    if (args.empty() || args.find_first_not_of("0123456789") != std::string::npos || args.size() > 9) {
+        this->queueSend(client, "ERROR usage: tail <n>\n");
+        return;
+    }
+
+    const RecentRing &recent = g_logger->getRecent();
+    uint64_t n = std::stoull(args);
+    uint64_t seq = recent.endSeq() - std::min(n, recent.endSeq() - recent.beginSeq());
+
+    std::string records;
+    for (; seq < recent.endSeq(); seq++) {
+        records.append(recent.at(seq));
+    }
+
+    this->queueSend(client, "TAIL " + std::to_string(records.size()) + "\n" + records);
+}
+
+/**
+ * Moves the log records a follower hasn't seen yet from the recent records
+ * ring to its output, as long as its output stays under
+ * `FOLLOW_OUTBUF_LIMIT`. A follower too slow to keep up with the ring
+ * doesn't hold anything back: it skips ahead to the oldest record still
+ * held and gets told how many it missed with a `SKIPPED <n>` line.
+ */
+void Server::pumpFollower(Client &client) noexcept {
+    if (client.transferFd != -1 || client.outbuf.size() >= FOLLOW_OUTBUF_LIMIT) {
+        return;
+    }
+
+    const RecentRing &recent = g_logger->getRecent();
+    if (client.followSeq == recent.endSeq()) {
+        return;
+    }
+
+    std::string records;
+    if (client.followSeq < recent.beginSeq()) {
+        records.append("SKIPPED " + std::to_string(recent.beginSeq() - client.followSeq) + "\n");
+        client.followSeq = recent.beginSeq();
+    }
+    while (client.followSeq < recent.endSeq() && client.outbuf.size() + records.size() < FOLLOW_OUTBUF_LIMIT) {
+        records.append(recent.at(client.followSeq));
+        client.followSeq += 1;
+    }
+
+    if (!records.empty()) {
+        this->queueSend(client, records);
+    }
+}
+
+void Server::pumpFollowers(void) noexcept {
+    for (const auto &client : this->clients) {
+        if (client->following) {
+            this->pumpFollower(*client);
+        }
+    }
+}
+
+/**
+ * Sends `data` to a client, queueing whatever can't be sent right away
+ * (socket buffer full, or output already queued ahead of it).
+ */
+void Server::queueSend(Client &client, const std::string &data) noexcept {
+    if (client.transferFd != -1) {
+        // Can't interleave with the transfer, goes right after it
+        client.afterTransfer.append(data);
+        return;
+    }
+
+    size_t sent = 0;
+    if (client.outbuf.empty()) {
+        ssize_t ret = send(client.socketfd, data.data(), data.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                g_logger->warn(std::string("send() failed: ") + strerror(errno));
+                return;
+            }
+        } else {
+            sent = static_cast<size_t>(ret);
+        }
+    }
+
+    if (sent < data.size()) {
+        client.outbuf.append(data, sent);
+        this->updateInterest(client);
+    }
+}
+
+/**
+ * Starts streaming the bytes of `fd` from `begin` to `end` to a client,
+ * after its queued output, or after the transfer in progress if there is
+ * one. Takes ownership of `fd`.
+ */
+void Server::startTransfer(Client &client, int fd, off_t begin, off_t end) noexcept {
+    if (client.transferFd != -1) {
+        client.nextTransfers.push_back({fd, begin, end});
+        return;
+    }
+    client.transferFd = fd;
+    client.transferOffset = begin;
+    client.transferEnd = end;
+    this->updateInterest(client);
+}
+
+/**
+ * Sends the ACKs a client has earned so far at once: one `ACK` per line in
+ * text mode, a single cumulative ACK frame in binary mode.
+ *
+ * @param client Client to acknowledge
+ */
+void Server::flushAcks(Client &client) noexcept {
+    std::string acks;
+
+    if (client.pendingAcks > 0) {
+        acks.reserve(sizeof(ACK_MSG) * client.pendingAcks);
+        for (int i = 0; i < client.pendingAcks; i++) {
+            acks.append(ACK_MSG, sizeof(ACK_MSG));
+        }
+        client.pendingAcks = 0;
+    }
+
+    if (client.ackSeqPending) {
+        uint32_t frameSize = htobe32(sizeof(uint64_t));
+        uint64_t seq = htobe64(client.ackSeq);
+        acks.append(reinterpret_cast<const char *>(&frameSize), sizeof(frameSize));
+        acks.append(reinterpret_cast<const char *>(&seq), sizeof(seq));
+        client.ackSeqPending = false;
+    }
+
+    if (!acks.empty()) {
+        this->queueSend(client, acks);
+    }
+
+#if MATT_TRACE
+    uint64_t ackTime = traceNow();
+    for (const TraceSample &sample : client.traceSamples) {
+        traceRecord(sample, ackTime);
+    }
+    client.traceSamples.clear();
+#endif
+}
+
+/**
+ * Writes everything logged so far to the main logfile and every shard's,
+ * waiting for the shards' writer threads, so it can be served.
+ */
+void Server::flushLogs(void) noexcept {
+    std::vector<uint64_t> tickets;
+    for (const auto &shard : this->shards) {
+        tickets.push_back(shard->request(false));
+    }
+    g_logger->flush();
+    for (size_t k = 0; k < tickets.size(); k++) {
+        this->shards[k]->wait(tickets[k]);
+    }
+}
+
+/**
+ * Writes and syncs the main logfile and every shard's. The shards' writer
+ * threads sync them all at once, alongside the main logfile's sync here,
+ * rather than one behind the other.
+ *
+ * @return Whether everything logged so far is durable, if not `errno` is
+ * set to the error of a failed `write()` or `fdatasync()`
+ */
+bool Server::syncLogs(void) noexcept {
+    std::vector<uint64_t> tickets;
+    for (const auto &shard : this->shards) {
+        tickets.push_back(shard->request(true));
+    }
+
+    int error = g_logger->sync() ? 0 : errno;
+    for (size_t k = 0; k < tickets.size(); k++) {
+        if (!this->shards[k]->wait(tickets[k]) && error == 0) {
+            error = errno;
         }
+    }
+    errno = error;
+    return error == 0;
+}
 
-        // Send ACK
-        if (send(clientFd, ACK_MSG, sizeof(ACK_MSG), MSG_DONTWAIT) == -1) {
-            g_logger->warn(std::string("send() failed: ") + strerror(errno));
+/**
+ * End of event loop iteration: makes the lines logged during this
+ * iteration as durable as the durability policy asks for and, on
+ * `Durability::GROUP`, releases the ACKs that were waiting for them.
+ * A single `fdatasync()` per logfile covers every client served in the
+ * iteration.
+ *
+ * If a sync fails, the clients waiting for ACKs are dropped: their lines
+ * may be lost, and as text ACKs are positional they'd take the next one as
+ * covering them. Reconnecting tells them to resend whatever wasn't
+ * acknowledged.
+ */
+void Server::commit(void) noexcept {
+    if (g_logger->getDurability() != Durability::GROUP) {
+        if (!g_logger->tick()) {
+            g_logger->error(std::string("failed to write or sync logfile: ") + strerror(errno));
+        }
+        for (size_t k = 0; k < this->shards.size(); k++) {
+            this->shards[k]->flush();
+            int error = this->shards[k]->takeError();
+            if (error != 0) {
+                g_logger->error("failed to write or sync logfile of shard " + std::to_string(k) + ": " + strerror(error));
+            }
         }
+        return;
+    }
+
+    bool hasPendingAcks = std::any_of(
+        this->clients.begin(),
+        this->clients.end(),
+        [](const std::unique_ptr<Client> &client) { return client->pendingAcks > 0 || client->ackSeqPending; });
+    if (!hasPendingAcks) {
+        // Nobody left waiting on a failed sync
+        this->syncFailed = false;
+        g_logger->flush();
+        for (const auto &shard : this->shards) {
+            shard->flush();
+        }
+        return;
+    }
+
+    if (!this->syncFailed && !this->syncLogs()) {
+        g_logger->error(std::string("failed to sync logfile: ") + strerror(errno));
+        this->syncFailed = true;
+    }
+    if (this->syncFailed) {
+        this->syncFailed = false;
+        int dropped = 0;
+        for (size_t i = 0; i < this->clients.size();) {
+            if (this->clients[i]->pendingAcks > 0 || this->clients[i]->ackSeqPending) {
+                this->disconnectClient(this->clients.begin() + i);
+                dropped += 1;
+            } else {
+                i++;
+            }
+        }
+        g_logger->warn("dropped " + std::to_string(dropped) + " client(s) whose lines could not be synced");
+        return;
+    }
+
+    for (const auto &client : this->clients) {
+        this->flushAcks(*client);
     }
 }
 
 void Server::start(void) noexcept {
     g_run = 1;
 
+    if (this->config.cpu >= 0) {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(this->config.cpu, &cpuset);
+        if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == -1) {
+            g_logger->warn("failed to pin event loop to CPU " + std::to_string(this->config.cpu) + ": sched_setaffinity() failed: " + strerror(errno));
+        }
+    }
+
     while (g_run) {
-        int nfds = epoll_wait(this->epollfd, this->events.data(), Server::MAX_EVENTS, -1);
+        int nfds = this->waitForEvents();
         if (nfds == -1) {
             if (errno != EINTR) {
                 g_logger->error(std::string("failed to wait for events on polled fds: epoll_wait() failed: ") + strerror(errno));
             }
-            continue;
+            // Interrupted by a signal most likely, still handle its flags below
+            nfds = 0;
         }
 
         for (int n = 0; n < nfds; n++) {
-            if (this->events[n].data.fd == this->socketfd) {
-                // Server's socket fd has events: new connections coming in
-                handleNewConnection();
-            } else {
+            int fd = this->events[n].data.fd;
+            uint32_t events = this->events[n].events;
+
+            if (fd == this->socketfd || fd == this->adminfd) {
+                // Server's or admin socket fd has events: new connections coming in
+                handleNewConnection(fd);
+                continue;
+            }
+
+            if (events & EPOLLOUT) {
+                // One of the clients' fds can be written to: pending output
+                handleClientWritable(fd);
+            }
+            if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
                 // One of the clients' fds has events: message coming in
-                handleClientMsg(this->events[n].data.fd);
+                handleClientMsg(fd);
             }
         }
+
+        this->enforceMemoryBudget();
+        this->commit();
+        this->pumpFollowers();
+
+        logReceivedSignals();
+        if (g_reopen) {
+            g_reopen = 0;
+            g_logger->reopen();
+            for (const auto &shard : this->shards) {
+                shard->reopen();
+            }
+            g_logger->notice("reopened logfile");
+        }
+
+#if MATT_TRACE
+        if (g_dumpTrace) {
+            g_dumpTrace = 0;
+            traceDump();
+        }
+#endif
     }
 }
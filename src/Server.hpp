@@ -3,31 +3,99 @@
 #include <sys/epoll.h>
 
 #include <array>
+#include <chrono>
 #include <memory>
 #include <ostream>
+#include <string>
 #include <vector>
 
 #include "Client.hpp"
+#include "Config.hpp"
+#include "ShardWriter.hpp"
+#include "Tintin_reporter.hpp"
 
 class Server {
     static constexpr const char ACK_MSG[] = "ACK\n";
+    static constexpr const char BINARY_MSG[] = "BINARY\n";
     static constexpr const char CLIENT_REJECTED_MSG[] = "Rejected due to client limit\n";
 
-    static constexpr const int MAX_CLIENTS = 3;
     static constexpr const int MAX_EVENTS = 10;
     static constexpr uint16_t PORT = (uint16_t)4242;
+    // Commands reading the logs back are served here, never on the messages' port
+    static constexpr const char ADMIN_SOCKET_PATH[] = "/var/run/matt_daemon.sock";
     static constexpr int RECV_BUFFER_SIZE = 1024;
+    // Packets handled per busy poll round, the kernel's default (BUSY_POLL_BUDGET)
+    static constexpr uint16_t BUSY_POLL_BUDGET = 8;
 
+    // Binary protocol: frames are a u32 payload length followed by the payload,
+    // a batch header (u64 sequence number of its first message, u32 message
+    // count) and then every message as a u32 length followed by its bytes.
+    // Integers are big-endian. ACKs are frames carrying a single u64, the
+    // sequence number of the last message acknowledged.
+    static constexpr size_t FRAME_LENGTH_SIZE = sizeof(uint32_t);
+    static constexpr size_t BATCH_HEADER_SIZE = sizeof(uint64_t) + sizeof(uint32_t);
+    static constexpr size_t MAX_FRAME_SIZE = 1024 * 1024;
+    static constexpr off_t TRANSFER_CHUNK_SIZE = 64 * 1024;
+    static constexpr size_t FOLLOW_OUTBUF_LIMIT = 64 * 1024;
+    // Clients not reading their ACKs/responses aren't read from, nor have their
+    // buffered commands handled, past this much pending output
+    static constexpr size_t OUTBUF_PAUSE_SIZE = 256 * 1024;
+    // Clients paused over the memory budget resume if the ones left reading make no progress for this long
+    static constexpr std::chrono::milliseconds PAUSE_STALL_TIMEOUT{100};
+
+    Config config;
     int epollfd;
     int socketfd;
+    int adminfd;
+    int spareFd;
     std::array<struct epoll_event, Server::MAX_EVENTS> events;
     std::vector<std::unique_ptr<Client>> clients;
+    size_t bufferedBytes;
+    // Some clients are paused over the memory budget, see enforceMemoryBudget()
+    bool readingPaused;
+    // Last read by a client holding partial data
+    std::chrono::steady_clock::time_point holderProgress;
+    // A sync failed: lines logged so far may be lost, see commit()
+    bool syncFailed;
+    std::vector<std::unique_ptr<ShardWriter>> shards;
+    uint64_t nextClientId;
+
+    std::vector<std::unique_ptr<Client>>::iterator findClient(int clientFd) noexcept;
+    void disconnectClient(std::vector<std::unique_ptr<Client>>::iterator clientIt) noexcept;
+    void updateInterest(Client &client) noexcept;
 
-    void handleNewConnection(void) noexcept;
+    void setBusyPoll(void) noexcept;
+    int waitForEvents(void) noexcept;
+
+    void handleNewConnection(int listenfd) noexcept;
+    bool registerClient(int clientSocketFd, bool admin) noexcept;
+    void rejectClient(int clientSocketFd) noexcept;
     void handleClientMsg(int clientFd) noexcept;
+    bool handleInput(std::vector<std::unique_ptr<Client>>::iterator clientIt) noexcept;
+    bool processInput(Client &client) noexcept;
+    bool handleFrame(Client &client, const char *payload, size_t size) noexcept;
+    ShardWriter &shardFor(const Client &client, const char *data, size_t size) noexcept;
+    bool logMessage(const Client &client, const char *data, size_t size) noexcept;
+    bool spillPartial(Client &client, bool force) noexcept;
+    void enforceMemoryBudget(void) noexcept;
+    void handleClientWritable(int clientFd) noexcept;
+    bool handleCommand(Client &client, const std::string &line, bool &keep) noexcept;
+    void handleAdminCommand(Client &client, const std::string &line) noexcept;
+    void handleQuery(Client &client, const std::string &args) noexcept;
+    void handleFetch(Client &client, const std::string &args) noexcept;
+    void handleTail(Client &client, const std::string &args) noexcept;
+    void pumpFollower(Client &client) noexcept;
+    void pumpFollowers(void) noexcept;
+
+    void queueSend(Client &client, const std::string &data) noexcept;
+    void startTransfer(Client &client, int fd, off_t begin, off_t end) noexcept;
+    void flushLogs(void) noexcept;
+    bool syncLogs(void) noexcept;
+    void flushAcks(Client &client) noexcept;
+    void commit(void) noexcept;
 
 public:
-    Server(void);
+    Server(const Config &config);
     Server(Server &rhs) noexcept;
     Server &operator=(Server &rhs) noexcept;
     ~Server(void) noexcept;
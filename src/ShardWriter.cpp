@@ -0,0 +1,217 @@
+#include "ShardWriter.hpp"
+
+#include <errno.h>
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Opens the shard's logfile and starts its writer thread, unless the
+ * logfile couldn't be opened (see `isValid()`).
+ *
+ * @param logfilePath Path of the shard's logfile
+ * @param durability Durability policy of the logfile
+ * @param syncIntervalMs `fdatasync()` period for `Durability::INTERVAL`
+ *
+ * @throws `std::system_error` if the thread can't be started
+ */
+ShardWriter::ShardWriter(const std::string &logfilePath, Durability durability, int syncIntervalMs) : reporter(logfilePath) {
+    this->reporter.setDurability(durability, syncIntervalMs);
+    this->queuedBytes = 0;
+    this->requested = 0;
+    this->syncRequested = 0;
+    this->reopenRequested = false;
+    this->completed = 0;
+    this->error = 0;
+    this->tickError = 0;
+    this->stopping = false;
+
+    if (this->reporter.isValid()) {
+        this->thread = std::thread(&ShardWriter::run, this);
+    }
+}
+
+/**
+ * Stops the writer thread once it has written what's queued. The logfile
+ * is then synced (or only written, on `Durability::NONE`) and closed.
+ */
+ShardWriter::~ShardWriter(void) noexcept {
+    if (this->thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->wakeup.notify_one();
+        this->thread.join();
+    }
+}
+
+/**
+ * @return Whether `ShardWriter` was successfully constructed (if it was able to open the logfile)
+ */
+bool ShardWriter::isValid(void) const noexcept {
+    return this->thread.joinable();
+}
+
+/**
+ * Queues a record for the logfile. It's written once the writer thread
+ * gets to it, at the latest on the next `flush()`. Waits for the writer
+ * thread if it's too far behind.
+ *
+ * @param timestamp Timestamp of the record
+ * @param line The record, newline included (see `Tintin_reporter::record()`)
+ */
+void ShardWriter::log(time_t timestamp, const std::string &line) noexcept {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    if (this->queuedBytes >= ShardWriter::MAX_QUEUED_BYTES) {
+        this->wakeup.notify_one();
+        this->done.wait(lock, [this]() { return this->queuedBytes < ShardWriter::MAX_QUEUED_BYTES; });
+    }
+    this->queue.emplace_back(timestamp, line);
+    this->queuedBytes += line.size();
+}
+
+/**
+ * Has the writer thread write the queued records, without waiting for
+ * it. Called once per event loop iteration, so a busy loop wakes the
+ * writer up once for all the records it logged.
+ */
+void ShardWriter::flush(void) noexcept {
+    bool queued;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        queued = !this->queue.empty();
+    }
+    if (queued) {
+        this->wakeup.notify_one();
+    }
+}
+
+/**
+ * Has the writer thread write the records queued so far and, if `sync`,
+ * sync the logfile.
+ *
+ * @param sync Whether to sync the logfile too
+ *
+ * @return Ticket to `wait()` for the request with
+ */
+uint64_t ShardWriter::request(bool sync) noexcept {
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        ticket = ++this->requested;
+        if (sync) {
+            this->syncRequested = ticket;
+        }
+    }
+    this->wakeup.notify_one();
+    return ticket;
+}
+
+/**
+ * Waits for a request to complete.
+ *
+ * @param ticket Ticket of the request, as returned by `request()`
+ *
+ * @return Whether it succeeded, if not `errno` is set to the error of the
+ * failed `write()` or `fdatasync()`
+ */
+bool ShardWriter::wait(uint64_t ticket) noexcept {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->done.wait(lock, [this, ticket]() { return this->completed >= ticket; });
+    errno = this->error;
+    return this->error == 0;
+}
+
+/**
+ * Closes and reopens the logfile, e.g. after it was rotated, once the
+ * records queued so far are written to it.
+ */
+void ShardWriter::reopen(void) noexcept {
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        ticket = ++this->requested;
+        this->reopenRequested = true;
+    }
+    this->wakeup.notify_one();
+    this->wait(ticket);
+}
+
+/**
+ * Writes and interval syncs happen on the writer thread, this passes
+ * their failures back to the event loop to report.
+ *
+ * @return errno of the first `write()` or interval `fdatasync()` that
+ * failed since the last call, 0 if none did
+ */
+int ShardWriter::takeError(void) noexcept {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    int error = this->tickError;
+    this->tickError = 0;
+    return error;
+}
+
+/**
+ * Writer thread: takes the whole queue at once whenever woken up, writes
+ * it and completes the requests made before it was taken. On
+ * `Durability::INTERVAL`, also wakes up to sync when the interval elapses.
+ */
+void ShardWriter::run(void) noexcept {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    std::vector<std::pair<time_t, std::string>> lines;
+
+    while (true) {
+        auto ready = [this]() {
+            return this->stopping || this->requested > this->completed || !this->queue.empty();
+        };
+        int timeout = this->reporter.pollTimeout();
+        if (timeout == -1) {
+            this->wakeup.wait(lock, ready);
+        } else {
+            this->wakeup.wait_for(lock, std::chrono::milliseconds(timeout), ready);
+        }
+
+        lines.swap(this->queue);
+        this->queuedBytes = 0;
+        uint64_t ticket = this->requested;
+        bool sync = this->syncRequested > this->completed;
+        bool reopen = this->reopenRequested;
+        this->reopenRequested = false;
+        bool stop = this->stopping;
+        lock.unlock();
+        // Logging may go on while this one writes
+        this->done.notify_all();
+
+        for (const auto &[timestamp, line] : lines) {
+            this->reporter.append(timestamp, line);
+        }
+        lines.clear();
+
+        int error = 0;
+        int tickError = 0;
+        if (sync) {
+            error = this->reporter.sync() ? 0 : errno;
+        } else if (!this->reporter.tick()) {
+            tickError = errno;
+        }
+        if (reopen) {
+            this->reporter.reopen();
+        }
+
+        lock.lock();
+        if (this->tickError == 0) {
+            this->tickError = tickError;
+        }
+        if (ticket > this->completed) {
+            this->completed = ticket;
+            this->error = error;
+            this->done.notify_all();
+        }
+        if (stop && this->queue.empty()) {
+            return;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <sys/types.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Tintin_reporter.hpp"
+
+/**
+ * Writer of a shard's logfile, on a thread of its own: the event loop
+ * queues the records and moves on, the writer thread writes them (and,
+ * for `Durability::INTERVAL`, syncs them) so the shards' `write()`s and
+ * `fdatasync()`s run side by side instead of one after another on the
+ * event loop.
+ *
+ * Everything the event loop needs done on the logfile (writing what's
+ * queued, syncing, reopening) is a request it may wait for with the
+ * ticket it gets back.
+ */
+class ShardWriter {
+    // Past this much queued, logging waits for the writer to catch up
+    static constexpr size_t MAX_QUEUED_BYTES = 4 * 1024 * 1024;
+
+    Tintin_reporter reporter;
+    std::mutex mutex;
+    // Wakes up the writer thread: records, requests or stopping
+    std::condition_variable wakeup;
+    // Wakes up the event loop: requests completed or queue taken
+    std::condition_variable done;
+    std::vector<std::pair<time_t, std::string>> queue;
+    size_t queuedBytes;
+    uint64_t requested;
+    uint64_t syncRequested;
+    bool reopenRequested;
+    uint64_t completed;
+    // errno of the failed sync of the last completed request, 0 if none
+    int error;
+    // errno of a failed write() or interval sync not taken yet, 0 if none
+    int tickError;
+    bool stopping;
+    std::thread thread;
+
+    void run(void) noexcept;
+
+public:
+    ShardWriter(const std::string &logfilePath, Durability durability, int syncIntervalMs);
+    ShardWriter(const ShardWriter &rhs) = delete;
+    ShardWriter &operator=(const ShardWriter &rhs) = delete;
+    ~ShardWriter(void) noexcept;
+
+    bool isValid(void) const noexcept;
+
+    void log(time_t timestamp, const std::string &line) noexcept;
+    void flush(void) noexcept;
+    uint64_t request(bool sync) noexcept;
+    bool wait(uint64_t ticket) noexcept;
+    void reopen(void) noexcept;
+    int takeError(void) noexcept;
+};
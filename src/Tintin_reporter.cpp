@@ -1,16 +1,30 @@
 #include "Tintin_reporter.hpp"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <chrono>
 #include <iomanip>
 #include <sstream>
 #include <string>
 
-Tintin_reporter::Tintin_reporter(const std::string &logfilePath) noexcept {
+Tintin_reporter::Tintin_reporter(const std::string &logfilePath) noexcept : index(logfilePath) {
     this->logfilePath = logfilePath;
-    this->logfile.open(logfilePath, std::ios::out | std::ios::app);
+    this->openLogfile();
+    this->sequenced = false;
+    this->sequence = 0;
+    this->durability = Durability::NONE;
+    this->syncInterval = std::chrono::milliseconds(0);
+    this->lastSync = std::chrono::steady_clock::now();
+    this->dirty = false;
+    this->writeError = 0;
+    this->torn = false;
 };
 
-Tintin_reporter::Tintin_reporter(const Tintin_reporter &rhs) noexcept {
+Tintin_reporter::Tintin_reporter(const Tintin_reporter &rhs) noexcept : index(rhs.index) {
+    this->logfd = -1;
     if (this != &rhs) {
         *this = rhs;
     }
@@ -18,19 +32,277 @@ Tintin_reporter::Tintin_reporter(const Tintin_reporter &rhs) noexcept {
 
 Tintin_reporter &Tintin_reporter::operator=(const Tintin_reporter &rhs) noexcept {
     if (this != &rhs) {
+        if (this->logfd != -1) {
+            this->flush();
+            close(this->logfd);
+        }
         this->logfilePath = rhs.logfilePath;
-        this->logfile.open(rhs.logfilePath, std::ios::out);
+        this->index = rhs.index;
+        this->recent = rhs.recent;
+        this->sequenced = rhs.sequenced;
+        this->sequence = rhs.sequence;
+        this->buffer.clear();
+        this->bufferIndex.clear();
+        this->openLogfile();
+        this->durability = rhs.durability;
+        this->syncInterval = rhs.syncInterval;
+        this->lastSync = rhs.lastSync;
+        this->dirty = false;
+        this->writeError = 0;
+        this->torn = false;
     }
     return *this;
 };
 
-Tintin_reporter::~Tintin_reporter(void) noexcept {};
+Tintin_reporter::~Tintin_reporter(void) noexcept {
+    if (this->logfd != -1) {
+        if (this->durability == Durability::NONE) {
+            this->flush();
+        } else {
+            this->sync();
+        }
+        close(this->logfd);
+    }
+};
 
 /**
  * @return Whether `Tintin_reporter` was successfully constructed (if it was able to open the logfile)
  */
 bool Tintin_reporter::isValid(void) const noexcept {
-    return this->logfile.is_open();
+    return this->logfd != -1;
+}
+
+const std::string &Tintin_reporter::getPath(void) const noexcept {
+    return this->logfilePath;
+}
+
+/**
+ * Opens the logfile for appending and brings its index up to date.
+ */
+void Tintin_reporter::openLogfile(void) noexcept {
+    this->logfd = open(this->logfilePath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (this->logfd == -1) {
+        return;
+    }
+
+    struct stat st;
+    if (fstat(this->logfd, &st) == 0) {
+        this->index.catchUp(this->logfilePath, st.st_size);
+    }
+}
+
+/**
+ * Closes and reopens the logfile and its index, e.g. after it was rotated.
+ * The index is rebuilt if it no longer matches the logfile.
+ */
+void Tintin_reporter::reopen(void) noexcept {
+    if (this->logfd != -1) {
+        if (this->durability == Durability::NONE) {
+            this->flush();
+        } else {
+            this->sync();
+        }
+        close(this->logfd);
+    }
+
+    this->index = LogIndex(this->logfilePath);
+    this->dirty = false;
+    this->openLogfile();
+}
+
+/**
+ * Sets the durability policy of the logfile.
+ *
+ * - `NONE`: lines are buffered and written once per event loop iteration
+ * (or when the buffer fills up), syncing is left to the page cache;
+ * - `INTERVAL`: same as `NONE`, plus an `fdatasync()` every `syncIntervalMs`
+ * whenever there is unsynced data;
+ * - `GROUP`: the caller is expected to call `sync()` once per event loop
+ * iteration and only acknowledge the lines logged before it afterwards.
+ *
+ * @param durability Durability policy
+ * @param syncIntervalMs `fdatasync()` period for `Durability::INTERVAL`
+ */
+void Tintin_reporter::setDurability(Durability durability, int syncIntervalMs) noexcept {
+    this->durability = durability;
+    this->syncInterval = std::chrono::milliseconds(syncIntervalMs);
+}
+
+Durability Tintin_reporter::getDurability(void) const noexcept {
+    return this->durability;
+}
+
+/**
+ * Sets the bounds of the in-memory history of recent log records, dropping
+ * the records held so far.
+ *
+ * @param maxRecords Maximum number of records held
+ * @param maxBytes Maximum size of the records held, in bytes
+ */
+void Tintin_reporter::setRecentLimits(size_t maxRecords, size_t maxBytes) noexcept {
+    this->recent = RecentRing(maxRecords, maxBytes);
+}
+
+/**
+ * @return The in-memory history of recent log records
+ */
+const RecentRing &Tintin_reporter::getRecent(void) const noexcept {
+    return this->recent;
+}
+
+/**
+ * Numbers the records formatted from now on: with --shards, one-second
+ * timestamps can't order the records of a producer spread over several
+ * logfiles, their sequence numbers can (see --merge).
+ *
+ * @param sequenced Whether to number the records
+ */
+void Tintin_reporter::setSequenced(bool sequenced) noexcept {
+    this->sequenced = sequenced;
+}
+
+/**
+ * Writes the buffered lines to the logfile and indexes them. Does not
+ * sync.
+ *
+ * The offsets indexed are taken from the file position after each
+ * `write()`, not counted, as other processes may append to the logfile
+ * too (`O_APPEND` places each write at the end of the file, wherever that
+ * is by then).
+ *
+ * If a `write()` fails (e.g. disk full), the lines it couldn't write are
+ * dropped and the next `sync()` fails, so nothing gets acknowledged as
+ * durable when it isn't.
+ */
+void Tintin_reporter::flush(void) noexcept {
+    if (this->logfd == -1) {
+        this->buffer.clear();
+        this->bufferIndex.clear();
+        return;
+    }
+
+    if (this->torn && !this->buffer.empty()) {
+        // End the line a failed write() cut short, the next one would be appended to it otherwise
+        ssize_t wr;
+        do {
+            wr = write(this->logfd, "\n", 1);
+        } while (wr == -1 && errno == EINTR);
+        if (wr == -1) {
+            this->writeError = errno;
+            this->buffer.clear();
+            this->bufferIndex.clear();
+            return;
+        }
+        this->torn = false;
+    }
+
+    size_t written = 0;
+    auto entry = this->bufferIndex.begin();
+    while (written < this->buffer.size()) {
+        ssize_t wr = write(this->logfd, this->buffer.data() + written, this->buffer.size() - written);
+        if (wr == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Drop what couldn't be written, see sync()
+            this->writeError = errno;
+            this->torn = written > 0 && this->buffer[written - 1] != '\n';
+            break;
+        }
+
+        // The file position is now the end of what was just written
+        off_t end = lseek(this->logfd, 0, SEEK_CUR);
+        off_t start = end - wr;
+        for (; entry != this->bufferIndex.end() && entry->second < written + wr; entry++) {
+            if (end != -1) {
+                this->index.record(entry->first, start + static_cast<off_t>(entry->second - written));
+            }
+        }
+        written += static_cast<size_t>(wr);
+    }
+
+    if (written > 0) {
+        this->dirty = true;
+    }
+    this->buffer.clear();
+    this->bufferIndex.clear();
+
+    // Only point the index at lines that made it to the logfile
+    this->index.flush();
+}
+
+/**
+ * Writes the buffered lines to the logfile and waits for them to reach
+ * the storage device.
+ *
+ * @return Whether everything logged so far is durable, if not `errno` is
+ * set to the error of the failed `write()` or `fdatasync()`
+ */
+bool Tintin_reporter::sync(void) noexcept {
+    this->flush();
+
+    // Lines dropped by a failed write() since the last sync are lost
+    int error = this->writeError;
+    this->writeError = 0;
+
+    if (this->dirty) {
+        int ret;
+        do {
+            ret = fdatasync(this->logfd);
+        } while (ret == -1 && errno == EINTR);
+
+        this->lastSync = std::chrono::steady_clock::now();
+        if (ret == -1) {
+            error = error != 0 ? error : errno;
+        } else {
+            this->dirty = false;
+        }
+    }
+
+    errno = error;
+    return error == 0;
+}
+
+/**
+ * End of event loop iteration housekeeping: writes the buffered lines
+ * and, for `Durability::INTERVAL`, syncs if the interval has elapsed.
+ *
+ * @return Whether the lines were written (and synced, if due), if not
+ * `errno` is set to the error. Always true on `Durability::GROUP`, where
+ * failures are left for the next `sync()` to report.
+ */
+bool Tintin_reporter::tick(void) noexcept {
+    this->flush();
+    if (this->durability == Durability::GROUP) {
+        return true;
+    }
+
+    if (this->durability == Durability::INTERVAL
+        && this->dirty
+        && std::chrono::steady_clock::now() - this->lastSync >= this->syncInterval) {
+        return this->sync();
+    }
+
+    int error = this->writeError;
+    this->writeError = 0;
+    errno = error;
+    return error == 0;
+}
+
+/**
+ * @return How long (in ms) the event loop may block before `tick()` has
+ * to run again, or -1 if it may block indefinitely
+ */
+int Tintin_reporter::pollTimeout(void) const noexcept {
+    if (this->durability != Durability::INTERVAL || (!this->dirty && this->buffer.empty())) {
+        return -1;
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - this->lastSync;
+    if (elapsed >= this->syncInterval) {
+        return 0;
+    }
+    return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(this->syncInterval - elapsed).count());
 }
 
 /**
@@ -88,37 +360,50 @@ void Tintin_reporter::fatal(const std::string &msg) noexcept {
 };
 
 /**
- * Gets the current timestamp and formats it as day/month/year
- * hour:minute:second.
+ * @param logfilePath Path of the main logfile, e.g. "/var/log/matt_daemon/matt_daemon.log"
+ * @param shard Shard number
  *
- * @return A string containing the timestamp
+ * @return Path of the logfile of shard `shard`, e.g. "/var/log/matt_daemon/matt_daemon.3.log"
  */
-const std::string Tintin_reporter::getTimestamp(void) const noexcept {
-    auto now = std::chrono::system_clock::now();
-    auto time_t_now = std::chrono::system_clock::to_time_t(now);
+std::string Tintin_reporter::shardPath(const std::string &logfilePath, int shard) noexcept {
+    size_t extension = logfilePath.rfind(".log");
+    if (extension == std::string::npos) {
+        return logfilePath + "." + std::to_string(shard);
+    }
+    return logfilePath.substr(0, extension) + "." + std::to_string(shard) + logfilePath.substr(extension);
+}
 
+/**
+ * Formats `time` as day/month/year hour:minute:second.
+ *
+ * @param time Time to format
+ *
+ * @return A string containing the timestamp
+ */
+const std::string Tintin_reporter::getTimestamp(time_t time) const noexcept {
     struct tm time_info;
-    localtime_r(&time_t_now, &time_info);
+    localtime_r(&time, &time_info);
 
     std::stringstream ss;
-    ss << std::put_time(&time_info, "%d/%m/%Y %H:%M:%S");
+    ss << std::put_time(&time_info, TIMESTAMP_FORMAT);
     return ss.str();
 }
 
 /**
- * Internal log function. Chooses the corresponding string
- * for the log level `level` and logs `msg` to the logfile
- * alongside a timestamp in a predefined format.
- * Example: [25/04/2025 03:05:54] [INFO] matt-daemon: started
+ * Formats a record and adds it to the in-memory history, without
+ * buffering it for the logfile: shards (see `ShardWriter`) have their
+ * records formatted by the main logger, so tail/follow serve the records
+ * of every shard together, and `append()`ed to their own logfile.
+ * Example: [25/04/2025 03:05:54] [INFO] matt-daemon: started, or
+ * [25/04/2025 03:05:54] [#42] [INFO] matt-daemon: started if sequenced
  *
  * @param level Log level
  * @param msg The message to log
+ * @param timestamp Where to store the timestamp of the record
+ *
+ * @return The record, newline included
  */
-void Tintin_reporter::_log(LogLevel level, const std::string &msg) noexcept {
-    if (!logfile.is_open()) {
-        return;
-    }
-
+std::string Tintin_reporter::record(LogLevel level, const std::string &msg, time_t &timestamp) noexcept {
     const char *levelStr;
 
     switch (level) {
@@ -145,6 +430,55 @@ void Tintin_reporter::_log(LogLevel level, const std::string &msg) noexcept {
             break;
     }
 
-    this->logfile << "[" << this->getTimestamp() << "] "
-                  << "[" << levelStr << "] " << this->LOG_PREFIX << " " << msg << std::endl;
+    timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+
+    std::string line;
+    line.append("[").append(this->getTimestamp(timestamp)).append("] ");
+    if (this->sequenced) {
+        line.append("[#").append(std::to_string(++this->sequence)).append("] ");
+    }
+    line.append("[").append(levelStr).append("] ");
+    line.append(this->LOG_PREFIX).append(" ").append(msg).append("\n");
+    this->recent.push(line);
+    return line;
+}
+
+/**
+ * Buffers a formatted record for the logfile, writing the buffer once it
+ * fills up.
+ *
+ * @param timestamp Timestamp of the record
+ * @param line The record, newline included
+ */
+void Tintin_reporter::append(time_t timestamp, const std::string &line) noexcept {
+    if (this->logfd == -1) {
+        return;
+    }
+
+    // The index only needs the first line of every second
+    if (this->bufferIndex.empty() || this->bufferIndex.back().first != timestamp) {
+        this->bufferIndex.emplace_back(timestamp, this->buffer.size());
+    }
+    this->buffer.append(line);
+
+    if (this->buffer.size() >= WRITE_BUFFER_SIZE) {
+        this->flush();
+    }
+}
+
+/**
+ * Internal log function: formats `msg` with its level and a timestamp
+ * and buffers it for the logfile.
+ *
+ * @param level Log level
+ * @param msg The message to log
+ */
+void Tintin_reporter::_log(LogLevel level, const std::string &msg) noexcept {
+    if (this->logfd == -1) {
+        return;
+    }
+
+    time_t timestamp;
+    std::string line = this->record(level, msg, timestamp);
+    this->append(timestamp, line);
 }
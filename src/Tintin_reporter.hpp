@@ -1,7 +1,16 @@
 #pragma once
 
-#include <fstream>
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include "LogIndex.hpp"
+#include "RecentRing.hpp"
 
 enum class LogLevel { LOG,
                       NOTICE,
@@ -10,22 +19,65 @@ enum class LogLevel { LOG,
                       ERROR,
                       FATAL };
 
+enum class Durability { NONE,
+                        INTERVAL,
+                        GROUP };
+
 class Tintin_reporter {
     static constexpr const char *LOG_PREFIX = "matt-daemon:";
+    static constexpr size_t WRITE_BUFFER_SIZE = 64 * 1024;
 
-    std::ofstream logfile;
+    int logfd;
     std::string logfilePath;
+    std::string buffer;
+    // Index entries of the buffered lines: timestamp and offset in `buffer`,
+    // the offsets in the logfile are only known once written
+    std::vector<std::pair<time_t, size_t>> bufferIndex;
+    LogIndex index;
+    RecentRing recent;
+    bool sequenced;
+    uint64_t sequence;
+
+    Durability durability;
+    std::chrono::milliseconds syncInterval;
+    std::chrono::steady_clock::time_point lastSync;
+    bool dirty;
+    // errno of a failed write() not reported by sync() yet, 0 if none
+    int writeError;
+    // The logfile ends with a line cut short by a failed write()
+    bool torn;
 
     void _log(LogLevel level, const std::string &msg) noexcept;
-    const std::string getTimestamp(void) const noexcept;
+    const std::string getTimestamp(time_t time) const noexcept;
+    void openLogfile(void) noexcept;
 
 public:
+    static constexpr const char *TIMESTAMP_FORMAT = "%d/%m/%Y %H:%M:%S";
+
     Tintin_reporter(const std::string &logfilePath) noexcept;
     Tintin_reporter(const Tintin_reporter &rhs) noexcept;
     Tintin_reporter &operator=(const Tintin_reporter &rhs) noexcept;
     ~Tintin_reporter(void) noexcept;
 
     bool isValid(void) const noexcept;
+    const std::string &getPath(void) const noexcept;
+    void reopen(void) noexcept;
+
+    void setDurability(Durability durability, int syncIntervalMs) noexcept;
+    Durability getDurability(void) const noexcept;
+
+    void setRecentLimits(size_t maxRecords, size_t maxBytes) noexcept;
+    const RecentRing &getRecent(void) const noexcept;
+
+    void setSequenced(bool sequenced) noexcept;
+
+    void flush(void) noexcept;
+    bool sync(void) noexcept;
+    bool tick(void) noexcept;
+    int pollTimeout(void) const noexcept;
+
+    std::string record(LogLevel level, const std::string &msg, time_t &timestamp) noexcept;
+    void append(time_t timestamp, const std::string &line) noexcept;
 
     void log(const std::string &msg) noexcept;
     void notice(const std::string &msg) noexcept;
@@ -33,4 +85,6 @@ public:
     void warn(const std::string &msg) noexcept;
     void error(const std::string &msg) noexcept;
     void fatal(const std::string &msg) noexcept;
+
+    static std::string shardPath(const std::string &logfilePath, int shard) noexcept;
 };
@@ -5,14 +5,22 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <csignal>
 #include <cstdlib>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <limits>
 #include <memory>
+#include <queue>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include "Client.hpp"
+#include "Config.hpp"
+#include "LogIndex.hpp"
 #include "Server.hpp"
 #include "Tintin_reporter.hpp"
 #include "signal.hpp"
@@ -164,7 +172,160 @@ void ft_daemon(int nochdir, int noclose) {
     close(pidFileFd);
 }
 
-int main(void) {
+/**
+ * @return Paths of the main logfile and of every shard's (matt_daemon.0.log,
+ * matt_daemon.1.log, ... up to the first missing one)
+ */
+static std::vector<std::string> logfilePaths(void) noexcept {
+    std::vector<std::string> paths{LOGFILE_PATH};
+    for (int k = 0; fs::exists(Tintin_reporter::shardPath(LOGFILE_PATH, k)); k++) {
+        paths.push_back(Tintin_reporter::shardPath(LOGFILE_PATH, k));
+    }
+    return paths;
+}
+
+/**
+ * Prints the lines of several logfiles as a single stream ordered by
+ * timestamp, k-way merging the files. Lines logged within the same second
+ * are ordered by their sequence number, or come file by file if they have
+ * none (logged without --shards).
+ *
+ * @param paths Logfiles to merge
+ * @param ranges Byte range of each logfile to print
+ *
+ * @return Exit status
+ */
+static int printMerged(const std::vector<std::string> &paths, const std::vector<LogRange> &ranges) noexcept {
+    std::vector<std::unique_ptr<std::ifstream>> logfiles;
+    std::vector<off_t> offsets;
+    for (size_t file = 0; file < paths.size(); file++) {
+        logfiles.push_back(std::make_unique<std::ifstream>(paths[file], std::ios::binary));
+        if (!logfiles.back()->is_open()) {
+            std::cerr << "matt-daemon: fatal: failed to open logfile " << paths[file] << ": " << strerror(errno) << "\n";
+            return EXIT_FAILURE;
+        }
+        logfiles.back()->seekg(ranges[file].begin);
+        offsets.push_back(ranges[file].begin);
+    }
+
+    // Next line of each file, keyed by (timestamp, sequence number, file)
+    using Head = std::tuple<time_t, uint64_t, size_t, std::string>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    std::vector<time_t> lastTimestamps(logfiles.size(), 0);
+    std::vector<uint64_t> lastSequences(logfiles.size(), 0);
+
+    auto readLine = [&](size_t file) {
+        std::string line;
+        if (offsets[file] >= ranges[file].end || !std::getline(*logfiles[file], line)) {
+            return;
+        }
+        offsets[file] += static_cast<off_t>(line.size()) + 1;
+        // Lines without a timestamp or sequence number stick to the one before them
+        time_t timestamp;
+        uint64_t sequence;
+        if (LogIndex::parseLineTimestamp(line, timestamp)) {
+            lastTimestamps[file] = timestamp;
+        }
+        if (LogIndex::parseLineSequence(line, sequence)) {
+            lastSequences[file] = sequence;
+        }
+        heads.emplace(lastTimestamps[file], lastSequences[file], file, std::move(line));
+    };
+
+    for (size_t file = 0; file < logfiles.size(); file++) {
+        readLine(file);
+    }
+    while (!heads.empty()) {
+        // Copy out before popping: the top is const
+        Head head = heads.top();
+        heads.pop();
+        std::cout << std::get<3>(head) << '\n';
+        readLine(std::get<2>(head));
+    }
+
+    std::cout.flush();
+    return std::cout.good() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/**
+ * Query mode: prints the logfile lines logged between `since` and `until`
+ * to stdout, reading only the byte range its index points to. With shards,
+ * the range of every shard's logfile is looked up in its own index and
+ * the ranges are merged (see `printMerged()`).
+ *
+ * @return Exit status
+ */
+static int runQuery(time_t since, time_t until) noexcept {
+    std::vector<std::string> paths = logfilePaths();
+    std::vector<LogRange> ranges(paths.size());
+    for (size_t file = 0; file < paths.size(); file++) {
+        if (!LogIndex::lookup(paths[file], since, until, ranges[file])) {
+            std::cerr << "matt-daemon: fatal: failed to look up the index of " << paths[file] << ": " << strerror(errno) << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    if (paths.size() > 1) {
+        return printMerged(paths, ranges);
+    }
+
+    const LogRange &range = ranges.front();
+    int logfd = open(LOGFILE_PATH, O_RDONLY | O_CLOEXEC);
+    if (logfd == -1) {
+        std::cerr << "matt-daemon: fatal: failed to open logfile: " << strerror(errno) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    char buf[64 * 1024];
+    off_t offset = range.begin;
+    while (offset < range.end) {
+        ssize_t rd = pread(logfd, buf, std::min(static_cast<off_t>(sizeof(buf)), range.end - offset), offset);
+        if (rd <= 0) {
+            break;
+        }
+        for (ssize_t written = 0; written < rd;) {
+            ssize_t wr = write(STDOUT_FILENO, buf + written, rd - written);
+            if (wr == -1) {
+                close(logfd);
+                return EXIT_FAILURE;
+            }
+            written += wr;
+        }
+        offset += rd;
+    }
+
+    close(logfd);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Merge mode: prints the lines of the main logfile and of every shard's
+ * as a single time-ordered stream (see `printMerged()`).
+ *
+ * @return Exit status
+ */
+static int runMerge(void) noexcept {
+    std::vector<std::string> paths = logfilePaths();
+    std::vector<LogRange> ranges(paths.size(), LogRange{0, std::numeric_limits<off_t>::max()});
+    return printMerged(paths, ranges);
+}
+
+int main(int argc, char **argv) {
+    Config config;
+    try {
+        config = parseArgs(argc, argv);
+    } catch (const std::invalid_argument &e) {
+        std::cerr << "matt-daemon: fatal: " << e.what() << "\n";
+        printUsage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (config.query) {
+        return runQuery(config.since, config.until);
+    }
+    if (config.merge) {
+        return runMerge();
+    }
+
     if (geteuid() != ROOT_UID) {
         std::cerr << "matt-daemon: fatal: root privileges needed\n";
         return EXIT_FAILURE;
@@ -183,29 +344,36 @@ int main(void) {
         return EXIT_FAILURE;
     }
 
-    g_logger = std::make_unique<Tintin_reporter>(LOGFILE_PATH);
-    if (!g_logger->isValid()) {
-        std::cerr << "matt-daemon: fatal: failed to open logfile\n";
-        return EXIT_FAILURE;
-    }
-
+    // Lock before opening the logfile: only the running instance may write to it and its index
     int lockfileFd = open(LOCKFILE_PATH, O_CREAT, 0400);
     if (lockfileFd == -1) {
-        g_logger->fatal(std::string("failed to open lock file: ") + strerror(errno));
+        std::cerr << "matt-daemon: fatal: failed to open lock file: " << strerror(errno) << "\n";
         return EXIT_FAILURE;
     }
     if (flock(lockfileFd, LOCK_EX | LOCK_NB) == -1) {
         if (errno == EWOULDBLOCK) {
-            g_logger->notice("there is an instance running already, exiting...");
+            std::cerr << "matt-daemon: there is an instance running already, exiting...\n";
             close(lockfileFd);
             return EXIT_SUCCESS;
         } else {
-            g_logger->fatal("failed to lock file");
+            std::cerr << "matt-daemon: fatal: failed to lock file: " << strerror(errno) << "\n";
             close(lockfileFd);
             return EXIT_FAILURE;
         }
     }
 
+    g_logger = std::make_unique<Tintin_reporter>(LOGFILE_PATH);
+    if (!g_logger->isValid()) {
+        std::cerr << "matt-daemon: fatal: failed to open logfile\n";
+        close(lockfileFd);
+        fs::remove(PIDFILE_PATH);
+        fs::remove(LOCKFILE_PATH);
+        return EXIT_FAILURE;
+    }
+    g_logger->setDurability(config.durability, config.syncIntervalMs);
+    g_logger->setRecentLimits(config.recentRecords, config.recentBytes);
+    g_logger->setSequenced(config.shards > 1);
+
     g_logger->info("started");
 
 #ifdef _DEBUG
@@ -228,7 +396,7 @@ int main(void) {
 
     int exitStatus = EXIT_SUCCESS;
     try {
-        Server server = Server();
+        Server server = Server(config);
         server.start();
     } catch (const std::runtime_error &e) {
         g_logger->fatal(std::string("failed to start server: ") + e.what());
@@ -5,10 +5,18 @@
 #include <stdexcept>
 
 #include "Tintin_reporter.hpp"
+#include "trace.hpp"
 
 extern volatile sig_atomic_t g_run;
+extern volatile sig_atomic_t g_reopen;
+#if MATT_TRACE
+extern volatile sig_atomic_t g_dumpTrace;
+#endif
 extern std::unique_ptr<Tintin_reporter> g_logger;
 
+// Signals received and not logged yet, indexed by signal number
+static volatile sig_atomic_t receivedSignals[NSIG];
+
 static constexpr int SIGNALS_TO_HANDLE[]{
     // User’s terminal is disconnected (daemons repurpose this to reload configurations)
     SIGHUP,
@@ -104,23 +112,56 @@ static const char *getSignalName(int signum) noexcept {
 }
 
 /**
- * Handles various signals by logging a message to the logfile and,
- * in case of `SIGINT` or `SIGTERM`, setting `g_run` to `0`. Otherwise
- * the signal is ignored.
+ * Handles various signals: in case of `SIGINT` or `SIGTERM`, sets `g_run`
+ * to `0`. `SIGHUP` sets `g_reopen` so the server loop reopens the logfile
+ * (e.g. after it was rotated), `SIGUSR1` sets `g_dumpTrace` so it logs the
+ * latency trace. Otherwise the signal is ignored.
+ *
+ * Only sets flags: the logger isn't async-signal-safe, the signal is
+ * logged by the server loop, see `logReceivedSignals()`.
  *
  * @param signum Signal number
  */
 void sigHandler(int signum) noexcept {
-    std::string msg = "Received ";
-    msg += getSignalName(signum);
-
     if (signum == SIGINT || signum == SIGTERM) {
         g_run = 0;
-    } else {
-        msg += ", ignoring...";
+    } else if (signum == SIGHUP) {
+        g_reopen = 1;
+#if MATT_TRACE
+    } else if (signum == SIGUSR1) {
+        g_dumpTrace = 1;
+#endif
     }
 
-    g_logger->notice(msg);
+    receivedSignals[signum] = 1;
+}
+
+/**
+ * Logs the signals received since the last call, from outside of the
+ * signal handler.
+ */
+void logReceivedSignals(void) noexcept {
+    for (size_t i = 0; i < sizeof(SIGNALS_TO_HANDLE) / sizeof(int); i += 1) {
+        int signum = SIGNALS_TO_HANDLE[i];
+        if (!receivedSignals[signum]) {
+            continue;
+        }
+        receivedSignals[signum] = 0;
+
+        std::string msg = "Received ";
+        msg += getSignalName(signum);
+        if (signum == SIGHUP) {
+            msg += ", reopening logfile...";
+#if MATT_TRACE
+        } else if (signum == SIGUSR1) {
+            msg += ", dumping latency trace...";
+#endif
+        } else if (signum != SIGINT && signum != SIGTERM) {
+            msg += ", ignoring...";
+        }
+
+        g_logger->notice(msg);
+    }
 }
 
 /**
@@ -134,4 +175,9 @@ void setupSignalHandlers(void) {
             throw std::runtime_error(std::string("failed to setup signal handler for ") + getSignalName(SIGNALS_TO_HANDLE[i]));
         }
     }
+
+    // sendfile() has no MSG_NOSIGNAL: a client leaving mid-transfer must fail it with EPIPE, not kill the daemon
+    if (std::signal(SIGPIPE, SIG_IGN) == SIG_ERR) {
+        throw std::runtime_error("failed to ignore SIGPIPE");
+    }
 }
@@ -4,3 +4,4 @@ void badsigHandler(int signum) noexcept;
 void sigintHandler(int signum) noexcept;
 void sigtermHandler(int signum) noexcept;
 void setupSignalHandlers(void);
+void logReceivedSignals(void) noexcept;
@@ -0,0 +1,138 @@
+#include "trace.hpp"
+
+#if MATT_TRACE
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+#include "Tintin_reporter.hpp"
+
+extern std::unique_ptr<Tintin_reporter> g_logger;
+
+static LatencyHistogram g_histograms[static_cast<size_t>(TraceStage::COUNT)];
+
+static constexpr const char *STAGE_NAMES[] = {
+    "recv->frame",
+    "frame->buffer",
+    "buffer->ack",
+    "recv->ack",
+};
+
+LatencyHistogram::LatencyHistogram(void) noexcept {
+    for (auto &count : this->counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    this->total.store(0, std::memory_order_relaxed);
+    this->maxValue.store(0, std::memory_order_relaxed);
+}
+
+LatencyHistogram::~LatencyHistogram(void) noexcept {}
+
+size_t LatencyHistogram::bucketOf(uint64_t ns) noexcept {
+    if (ns < LINEAR_MAX) {
+        return ns;
+    }
+
+    // Keep the SUB_BUCKET_BITS bits below the most significant one
+    int shift = std::bit_width(ns) - SUB_BUCKET_BITS - 1;
+    if (shift > MAX_SHIFT) {
+        return BUCKETS - 1;
+    }
+    return LINEAR_MAX + (shift - 1) * SUB_BUCKETS + ((ns >> shift) - SUB_BUCKETS);
+}
+
+/**
+ * @return Middle of the range of values counted in `bucket`
+ */
+uint64_t LatencyHistogram::valueOf(size_t bucket) noexcept {
+    if (bucket < LINEAR_MAX) {
+        return bucket;
+    }
+
+    int shift = (bucket - LINEAR_MAX) / SUB_BUCKETS + 1;
+    uint64_t top = (bucket - LINEAR_MAX) % SUB_BUCKETS + SUB_BUCKETS;
+    return (top << shift) + (uint64_t(1) << shift) / 2;
+}
+
+void LatencyHistogram::record(uint64_t ns) noexcept {
+    this->counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+    this->total.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = this->maxValue.load(std::memory_order_relaxed);
+    while (ns > max && !this->maxValue.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {
+    }
+}
+
+uint64_t LatencyHistogram::count(void) const noexcept {
+    return this->total.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::max(void) const noexcept {
+    return this->maxValue.load(std::memory_order_relaxed);
+}
+
+/**
+ * @param p Percentile, in ]0, 100]
+ *
+ * @return Value (ns) at percentile `p`, 0 if nothing was recorded
+ */
+uint64_t LatencyHistogram::percentile(double p) const noexcept {
+    uint64_t total = this->count();
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKETS; bucket++) {
+        seen += this->counts[bucket].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(valueOf(bucket), this->max());
+        }
+    }
+    return this->max();
+}
+
+/**
+ * Records the per-stage latencies of an acknowledged message.
+ *
+ * @param sample Timestamps of the message
+ * @param ack Time its ACK was sent
+ */
+void traceRecord(const TraceSample &sample, uint64_t ack) noexcept {
+    g_histograms[static_cast<size_t>(TraceStage::RECV_TO_FRAME)].record(sample.frame - sample.recv);
+    g_histograms[static_cast<size_t>(TraceStage::FRAME_TO_BUFFER)].record(sample.buffer - sample.frame);
+    g_histograms[static_cast<size_t>(TraceStage::BUFFER_TO_ACK)].record(ack - sample.buffer);
+    g_histograms[static_cast<size_t>(TraceStage::RECV_TO_ACK)].record(ack - sample.recv);
+}
+
+/**
+ * Logs a percentile table (in microseconds) per stage.
+ */
+void traceDump(void) noexcept {
+    g_logger->info("latency trace (us):               count       p50       p90       p99     p99.9       max");
+
+    for (size_t stage = 0; stage < static_cast<size_t>(TraceStage::COUNT); stage++) {
+        const LatencyHistogram &histogram = g_histograms[stage];
+
+        char line[160];
+        snprintf(line, sizeof(line), "latency trace %-13s %11lu %9.1f %9.1f %9.1f %9.1f %9.1f",
+                 STAGE_NAMES[stage],
+                 static_cast<unsigned long>(histogram.count()),
+                 histogram.percentile(50) / 1000.0,
+                 histogram.percentile(90) / 1000.0,
+                 histogram.percentile(99) / 1000.0,
+                 histogram.percentile(99.9) / 1000.0,
+                 histogram.max() / 1000.0);
+        g_logger->info(line);
+    }
+}
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+// Per-message latency tracing, compiled out entirely with -D MATT_TRACE=0
+#ifndef MATT_TRACE
+#define MATT_TRACE 1
+#endif
+
+#include <time.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Lock-free latency histogram with HDR-like log-linear buckets: exact up
+ * to 64ns, then 32 buckets per power of two (~3% precision), up to ~73
+ * minutes. Recording is a couple of relaxed atomic increments.
+ */
+class LatencyHistogram {
+    static constexpr int SUB_BUCKET_BITS = 5;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static constexpr uint64_t LINEAR_MAX = SUB_BUCKETS * 2;
+    static constexpr int MAX_SHIFT = 36;
+    static constexpr size_t BUCKETS = LINEAR_MAX + MAX_SHIFT * SUB_BUCKETS;
+
+    std::array<std::atomic<uint64_t>, BUCKETS> counts;
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> maxValue;
+
+    static size_t bucketOf(uint64_t ns) noexcept;
+    static uint64_t valueOf(size_t bucket) noexcept;
+
+public:
+    LatencyHistogram(void) noexcept;
+    LatencyHistogram(const LatencyHistogram &rhs) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &rhs) = delete;
+    ~LatencyHistogram(void) noexcept;
+
+    void record(uint64_t ns) noexcept;
+    uint64_t count(void) const noexcept;
+    uint64_t max(void) const noexcept;
+    uint64_t percentile(double p) const noexcept;
+};
+
+enum class TraceStage { RECV_TO_FRAME,
+                        FRAME_TO_BUFFER,
+                        BUFFER_TO_ACK,
+                        RECV_TO_ACK,
+                        COUNT };
+
+// Timestamps of a message along its way, in ns on CLOCK_MONOTONIC: read
+// (first byte of its line or frame), line or frame complete, and handed to
+// the logger's buffer (written out and synced later, by Server::commit())
+struct TraceSample {
+    uint64_t recv;
+    uint64_t frame;
+    uint64_t buffer;
+};
+
+/**
+ * @return Current CLOCK_MONOTONIC time, in ns
+ */
+inline uint64_t traceNow(void) noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void traceRecord(const TraceSample &sample, uint64_t ack) noexcept;
+void traceDump(void) noexcept;